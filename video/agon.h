@@ -20,6 +20,9 @@
 #define MAX_BITMAPS				256		// Maximum number of bitmaps
 
 #define UART_BR					1152000	// Max baud rate; previous stable value was 384000
+#define UART_BR_MIN				9600	// Lowest rate the host can switch to
+#define UART_BR_MAX				5000000	// Highest rate the host can switch to (the ESP32 UART limit)
+#define UART_BR_CONFIRM_TIMEOUT	500		// Time the host has to confirm a new rate before we fall back (ms)
 #define UART_NA					-1
 #define UART_TX					2
 #define UART_RX					34
@@ -31,6 +34,14 @@
 #define UART_RX_SIZE			256		// The RX buffer size
 #define UART_RX_THRESH			128		// Point at which RTS is toggled
 
+#define UART_RX_RING_SIZE		32768	// Size of the PSRAM receive ring (must be a power of 2)
+#define UART_RX_RING_HIGH		(UART_RX_RING_SIZE * 3 / 4)	// Ring level at which we stop draining the UART (raising RTS)
+#define UART_RX_RING_LOW		(UART_RX_RING_SIZE / 2)		// Ring level at which we start draining it again
+#define UART_RX_TASK_PRIORITY	3		// Receive task priority
+#define UART_RX_TASK_CORE		0		// Receive task runs on the core not used by the main loop
+#define PACKET_BUFFER_SIZE		512		// Outbound staging buffer size (must hold at least one 257 byte packet)
+#define VDP_PERF_COUNTERS		1		// Per-command performance counters: 1 = enable
+
 #define GPIO_ITRP				17		// VSync Interrupt Pin - for reference only
 
 // Commands for VDU 23, 0, n
@@ -45,8 +56,16 @@
 #define VDP_RTC					0x87	// RTC
 #define VDP_KEYSTATE			0x88	// Keyboard repeat rate and LED status
 #define VDP_MOUSE				0x89	// Mouse data
+#define VDP_RXSTATS				0x8A	// Receive ring statistics
+#define VDP_TXSTATS				0x8B	// Outbound packet statistics
+#define VDP_PERFSTATS			0x8C	// Per-command performance counters
+#define VDP_PERFRESET			0x8D	// Reset the performance counters
+#define VDP_RESYNC				0x8E	// Resynchronisation marker
+#define VDP_BAUDRATE			0x8F	// Switch to a new baud rate
 #define VDP_BUFFERED			0xA0	// Buffered commands
 #define VDP_UPDATER				0xA1	// Update VDP
+#define VDP_FRAME				0xA2	// Execute a checksummed frame of VDU commands
+#define VDP_COMPRESSED_FRAME	0xA3	// Execute an LZ4 compressed frame of VDU commands
 #define VDP_LOGICALCOORDS		0xC0	// Switch BBC Micro style logical coords on and off
 #define VDP_LEGACYMODES			0xC1	// Switch VDP 1.03 compatible modes on and off
 #define VDP_SWITCHBUFFER		0xC3	// Double buffering control
@@ -66,6 +85,32 @@
 #define PACKET_RTC				0x07	// RTC
 #define PACKET_KEYSTATE			0x08	// Keyboard repeat rate and LED status
 #define PACKET_MOUSE			0x09	// Mouse data
+#define PACKET_RXSTATS			0x0A	// Receive ring statistics
+#define PACKET_TXSTATS			0x0B	// Outbound packet statistics
+#define PACKET_PERFSTATS		0x0C	// Per-command performance counters
+#define PACKET_RESYNC			0x0D	// Protocol desync and resync events
+#define PACKET_BAUDRATE			0x0E	// Baud rate switch status
+#define PACKET_BUFFERWRITE		0x0F	// Large buffer write status
+#define PACKET_CALLDEPTH		0x10	// Buffer call nested too deeply
+#define PACKET_BUFFERSHARING	0x11	// Buffer data sharing statistics
+#define PACKET_BUFFERMEMORY		0x12	// Buffer memory use, and the largest buffers
+#define PACKET_BUFFEREVICTED	0x13	// Cacheable buffers evicted to make room
+#define PACKET_BUFFERPOOL		0x14	// Buffer pool and PSRAM fragmentation statistics
+
+// Resync marker, sent by the host as VDU 23, 0, &8E, "SYNC"
+// Once one has been seen, a command that times out part-way through makes the VDP
+// discard input until the next marker, rather than running the rest of it as fresh commands
+//
+#define RESYNC_MARKER			{ 0x17, 0x00, VDP_RESYNC, 'S', 'Y', 'N', 'C' }
+#define RESYNC_MARKER_LENGTH	7
+
+#define RESYNC_EVENT_DESYNC		0		// A command timed out, and input is being discarded
+#define RESYNC_EVENT_RESYNC		1		// A marker has been found, and commands are running again
+
+#define BAUDRATE_REFUSED		0		// The rate is out of range, or the command didn't come from the host
+#define BAUDRATE_SWITCHING		1		// Switching now; the host should switch and confirm
+#define BAUDRATE_CONFIRMED		2		// The host confirmed the new rate
+#define BAUDRATE_FALLBACK		3		// No confirmation arrived, so the previous rate has been restored
 
 #define AUDIO_CHANNELS			3		// Default number of audio channels
 #define MAX_AUDIO_CHANNELS		32		// Maximum number of audio channels
@@ -137,6 +182,7 @@
 #define MOUSE_SET_SCALING		8		// Set mouse scaling
 #define MOUSE_SET_ACCERATION	9		// Set mouse acceleration (1-2000)
 #define MOUSE_SET_WHEELACC		10		// Set mouse wheel acceleration
+#define MOUSE_SET_REPORTINTERVAL	11	// Set minimum interval between mouse reports
 
 #define MOUSE_DEFAULT_CURSOR	0;		// Default mouse cursor
 #define MOUSE_DEFAULT_SAMPLERATE	60;	// Default mouse sample rate
@@ -144,6 +190,9 @@
 #define MOUSE_DEFAULT_SCALING	1;		// Default mouse scaling (1:1)
 #define MOUSE_DEFAULT_ACCELERATION	180;	// Default mouse acceleration 
 #define MOUSE_DEFAULT_WHEELACC		60000;	// Default mouse wheel acceleration
+#define MOUSE_DEFAULT_REPORTINTERVAL	0	// Default mouse report interval (report every movement)
+#define MOUSE_REPORT_FRAME			255		// Report interval value for at most one report per frame
+#define MOUSE_FRAME_INTERVAL		16		// Milliseconds per frame at 60Hz
 
 // Buffered commands
 #define BUFFERED_WRITE			0x00	// Write to a numbered buffer
@@ -171,8 +220,30 @@
 #define BUFFERED_SPREAD_FROM	0x16	// Spread blocks from target buffer ID onwards
 #define BUFFERED_REVERSE_BLOCKS	0x17	// Reverse the order of blocks in a buffer
 #define BUFFERED_REVERSE		0x18	// Reverse the order of data in a buffer
+#define BUFFERED_WRITE_COMPRESSED	0x19	// Write LZ4 compressed data to a numbered buffer
+#define BUFFERED_WRITE_LARGE	0x1A	// Write up to 16MB to a numbered buffer, resumably
+#define BUFFERED_SHARING_STATS	0x1B	// Report how much buffer data is shared between copies
+#define BUFFERED_MEMORY_STATS	0x1C	// Report buffer memory use, and the largest buffers
+#define BUFFERED_SET_CACHEABLE	0x1D	// Mark a buffer as cacheable, so it can be evicted when memory runs out
+#define BUFFERED_SET_QUOTA		0x1E	// Limit the memory used by buffer data
+#define BUFFERED_POOL_STATS		0x1F	// Report buffer pool and PSRAM fragmentation statistics
 
 #define BUFFERED_DEBUG_INFO		0x20	// Get debug info about a buffer
+#define BUFFERED_INTERLEAVE		0x21	// Interleave buffers into a buffer by width
+#define BUFFERED_INTERLEAVE_FROM	0x22	// Interleave buffers from a source bufferId onwards
+#define BUFFERED_LOOP			0x23	// Call a buffer a number of times
+#define BUFFERED_LOOP_WHILE		0x24	// Call a buffer for as long as a condition holds
+#define BUFFERED_REGISTER		0x25	// Operate on a register
+#define BUFFERED_REG_COND_CALL	0x26	// Call a buffer depending on a register
+#define BUFFERED_REG_COND_JUMP	0x27	// Jump to a buffer depending on a register
+#define BUFFERED_SET_PARAMETERS	0x28	// Set where arguments are substituted into a buffer
+#define BUFFERED_CALL_ARGS		0x29	// Call a buffer with arguments
+
+// Large write status codes
+#define BUFFER_WRITE_COMPLETE	0		// Large write status: all data received and stored
+#define BUFFER_WRITE_PARTIAL	1		// Large write status: stalled, and can be resumed from the reported offset
+#define BUFFER_WRITE_FAILED		2		// Large write status: couldn't allocate, or bad resume offset; data discarded
+#define BUFFER_WRITE_STALL_TIMEOUT	2000	// Time without any data before a large write is suspended (ms)
 
 // Adjust operation codes
 #define ADJUST_NOT				0x00	// Adjust: NOT
@@ -183,6 +254,10 @@
 #define ADJUST_AND				0x05	// Adjust: AND
 #define ADJUST_OR				0x06	// Adjust: OR
 #define ADJUST_XOR				0x07	// Adjust: XOR
+#define ADJUST_ADD_16			0x08	// Adjust: add 16-bit little-endian values
+#define ADJUST_SUB_16			0x09	// Adjust: subtract 16-bit little-endian values
+#define ADJUST_ADD_32			0x0A	// Adjust: add 32-bit little-endian values
+#define ADJUST_SUB_32			0x0B	// Adjust: subtract 32-bit little-endian values
 
 // Adjust operation flags
 #define ADJUST_OP_MASK			0x0F	// operation code mask
@@ -207,6 +282,28 @@
 #define COND_OP_MASK			0x0F	// conditional operation code mask
 #define COND_ADVANCED_OFFSETS	0x10	// advanced offset values
 #define COND_BUFFER_VALUE		0x20	// value to compare is a buffer-fetched value
+#define COND_16BIT				0x40	// compare 16-bit little-endian values
+#define COND_32BIT				0x80	// compare 32-bit little-endian values
+
+// Register operation codes
+#define REG_LOAD				0x00	// Register: load from buffer
+#define REG_STORE				0x01	// Register: store to buffer
+#define REG_SET					0x02	// Register: set new value
+#define REG_ADD					0x03	// Register: add
+#define REG_SUB					0x04	// Register: subtract
+#define REG_MUL					0x05	// Register: multiply
+#define REG_AND					0x06	// Register: AND
+#define REG_OR					0x07	// Register: OR
+#define REG_XOR					0x08	// Register: XOR
+#define REG_SHIFT_LEFT			0x09	// Register: shift left
+#define REG_SHIFT_RIGHT			0x0A	// Register: shift right
+
+// Register operation flags
+#define REG_OP_MASK				0x0F	// register operation code mask
+#define REG_ADVANCED_OFFSETS	0x10	// advanced offset values, for load and store
+#define REG_REGISTER_VALUE		0x20	// operand is another register, rather than an immediate value
+#define REG_16BIT				0x40	// 16-bit little-endian buffer values and immediate operands
+#define REG_32BIT				0x80	// 32-bit little-endian buffer values and immediate operands
 
 // Reverse operation flags
 #define REVERSE_16BIT			0x01	// 16-bit value length
@@ -216,6 +313,23 @@
 #define REVERSE_BLOCK			0x08	// reverse block order
 #define REVERSE_UNUSED_BITS		0xF0	// unused bits
 
+// Buffer memory stats flags
+#define BUFFER_MEMORY_CACHEABLE	0x01	// Memory stats flag: buffer is cacheable
+#define BUFFER_MEMORY_BITMAP	0x02	// Memory stats flag: buffer has a bitmap made from it
+#define BUFFER_MEMORY_SAMPLE	0x04	// Memory stats flag: buffer has a sample made from it
+
+// Buffer limits
+#define DECODED_BUFFER_MAX_COPY	65536	// Largest multi-block buffer that will be copied in order to decode it
+#define BUFFER_CALL_MAX_DEPTH	32		// Deepest nesting of buffer calls
+#define BUFFER_REGISTERS		16		// Number of registers for buffered programs
+#define BUFFER_CALL_MAX_ARGS	16		// Most arguments passed to a buffer call
+#define BUFFER_MEMORY_MAX_LIST	32		// Most buffers listed in a memory stats packet
+#define BUFFER_EVICTED_MAX_LIST	127		// Most buffer IDs in one eviction packet
+#define BUFFER_POOL_SLAB_SIZE	4096	// Size of each slab in the buffer pool
+#define BUFFER_POOL_MIN_SIZE	16		// Smallest size class in the buffer pool (must be a power of 2)
+#define BUFFER_POOL_CLASSES		6		// Number of size classes, each double the last
+#define BUFFER_POOL_MAX_SIZE	(BUFFER_POOL_MIN_SIZE << (BUFFER_POOL_CLASSES - 1))	// Largest allocation taken from a slab
+
 // Buffered bitmap and sample info
 #define BUFFERED_BITMAP_BASEID	0xFA00	// Base ID for buffered bitmaps
 #define BUFFERED_SAMPLE_BASEID	0xFB00	// Base ID for buffered samples
@@ -23,7 +23,7 @@
 std::unordered_map<uint8_t, std::shared_ptr<audio_channel>> audio_channels;
 std::vector<TaskHandle_t, psram_allocator<TaskHandle_t>> audioHandlers;
 
-std::unordered_map<uint16_t, std::shared_ptr<audio_sample>> samples;	// Storage for the sample data
+IdTable<std::shared_ptr<audio_sample>> samples;	// Storage for the sample data
 
 fabgl::SoundGenerator		SoundGenerator;		// The audio class
 
@@ -130,15 +130,22 @@ void setWaveform(uint8_t channel, int8_t waveformType, uint16_t sampleId) {
 //
 uint8_t clearSample(uint16_t sampleId) {
 	debug_log("clearSample: sample %d\n\r", sampleId);
-	if (samples.find(sampleId) == samples.end()) {
+	if (samples.erase(sampleId) == 0) {
 		debug_log("clearSample: sample %d not found\n\r", sampleId);
 		return 0;
 	}
-	samples.erase(sampleId);
 	debug_log("reset sample\n\r");
 	return 1;
 }
 
+// Check whether a sample is being played, by any channel that was set to use it
+//
+bool sampleInUse(uint16_t sampleId) {
+	auto sample = samples.find(sampleId);
+	// channels playing a sample hold a reference to it
+	return sample != samples.end() && sample->second.use_count() > 1;
+}
+
 // Reset samples
 //
 void resetSamples() {
@@ -20,6 +20,10 @@ uint8_t			mResolution = MOUSE_DEFAULT_RESOLUTION;	// Mouse resolution
 uint8_t			mScaling = MOUSE_DEFAULT_SCALING;	// Mouse scaling
 uint16_t		mAcceleration = MOUSE_DEFAULT_ACCELERATION;	// Mouse acceleration
 uint32_t		mWheelAcc = MOUSE_DEFAULT_WHEELACC;	// Mouse wheel acceleration
+uint8_t			mReportInterval = MOUSE_DEFAULT_REPORTINTERVAL;	// Minimum ms between mouse reports
+MouseDelta		mReportDelta = {};				// Movement accumulated since the last mouse report
+bool			mReportPending = false;			// Movement is waiting to be reported
+uint32_t		mReportTime = 0;				// When the last mouse report was sent
 
 // Forward declarations
 //
@@ -363,6 +367,14 @@ bool setMousePos(uint16_t x, uint16_t y) {
 	return true;
 }
 
+// Set the minimum interval between mouse reports, in milliseconds
+// 0 reports every movement, and MOUSE_REPORT_FRAME reports at most once per frame
+//
+bool setMouseReportInterval(uint8_t interval) {
+	mReportInterval = interval;
+	return true;
+}
+
 bool resetMouse() {
 	auto mouse = getMouse();
 	if (!mouse) {
@@ -375,6 +387,7 @@ bool resetMouse() {
 	setMouseScaling(0);
 	setMouseAcceleration(0);
 	setMouseWheelAcceleration(0);
+	setMouseReportInterval(MOUSE_DEFAULT_REPORTINTERVAL);
 	return mouse->reset();
 }
 
@@ -394,4 +407,47 @@ bool mouseMoved(MouseDelta * delta) {
 	return false;
 }
 
+// Add a mouse delta to the pending report
+// Movement is accumulated, so that at most one report is sent per report interval
+// Returns:
+// - true if the report should be sent straight away, as a button or the wheel has changed
+//
+bool queueMouseReport(MouseDelta * delta) {
+	auto & pending = mReportDelta;
+	bool immediate = mReportInterval == 0 || delta->deltaZ != 0
+		|| delta->buttons.left != pending.buttons.left
+		|| delta->buttons.middle != pending.buttons.middle
+		|| delta->buttons.right != pending.buttons.right;
+
+	pending.deltaX = std::max(-32768, std::min(32767, pending.deltaX + delta->deltaX));
+	pending.deltaY = std::max(-32768, std::min(32767, pending.deltaY + delta->deltaY));
+	pending.deltaZ = delta->deltaZ;
+	pending.buttons = delta->buttons;
+	mReportPending = true;
+	return immediate;
+}
+
+// Take the pending mouse report, if there is one and the report interval has passed
+// Setting force takes it regardless of the interval
+// Returns:
+// - true with the accumulated delta in report, otherwise false
+//
+bool takeMouseReport(MouseDelta * report, bool force = false) {
+	if (!mReportPending) {
+		return false;
+	}
+	auto now = millis();
+	uint32_t interval = mReportInterval == MOUSE_REPORT_FRAME ? MOUSE_FRAME_INTERVAL : mReportInterval;
+	if (!force && now - mReportTime < interval) {
+		return false;
+	}
+	*report = mReportDelta;
+	mReportDelta.deltaX = 0;
+	mReportDelta.deltaY = 0;
+	mReportDelta.deltaZ = 0;
+	mReportPending = false;
+	mReportTime = now;
+	return true;
+}
+
 #endif // AGON_PS2_H
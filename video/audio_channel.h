@@ -6,6 +6,7 @@
 #include <fabgl.h>
 
 #include "agon.h"
+#include "id_table.h"
 #include "types.h"
 #include "envelopes/volume.h"
 #include "envelopes/frequency.h"
@@ -49,7 +50,7 @@ class audio_channel {
 
 #include "audio_sample.h"
 #include "enhanced_samples_generator.h"
-extern std::unordered_map<uint16_t, std::shared_ptr<audio_sample>> samples;	// Storage for the sample data
+extern IdTable<std::shared_ptr<audio_sample>> samples;	// Storage for the sample data
 
 audio_channel::audio_channel(uint8_t channel) {
 	this->_channel = channel;
@@ -123,10 +124,11 @@ uint8_t audio_channel::getStatus() {
 }
 
 std::unique_ptr<fabgl::WaveformGenerator> audio_channel::getSampleWaveform(uint16_t sampleId, std::shared_ptr<audio_channel> channelRef) {
-	if (samples.find(sampleId) != samples.end()) {
-		auto sample = samples.at(sampleId);
+	auto found = samples.find(sampleId);
+	if (found != samples.end()) {
+		auto sample = found->second;
 		// remove this channel from other samples
-		for (auto samplePair : samples) {
+		for (auto & samplePair : samples) {
 			if (samplePair.second) {
 				samplePair.second->channels.erase(_channel);
 			}
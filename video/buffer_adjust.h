@@ -0,0 +1,92 @@
+#ifndef BUFFER_ADJUST_H
+#define BUFFER_ADJUST_H
+
+#include <cstring>
+#include <stdint.h>
+
+#include "agon.h"
+
+// Kernels for bufferAdjust, working on a contiguous span of bytes within one block
+// Bytes before the first word boundary are done one at a time, then whole 32-bit words,
+// then any bytes left over at the end
+// Words are read and written in native (little-endian) order, so adding with carry
+// across a whole word gives the same result as a chain of byte-wise adds with carry
+
+#define ADJUST_BYTE_HIGH_BITS	0x80808080
+
+// Byte-wise add of each byte in a word, without carries between bytes
+//
+inline uint32_t addBytes(uint32_t a, uint32_t b) {
+	return ((a & ~ADJUST_BYTE_HIGH_BITS) + (b & ~ADJUST_BYTE_HIGH_BITS)) ^ ((a ^ b) & ADJUST_BYTE_HIGH_BITS);
+}
+
+// Byte-wise negate of each byte in a word
+//
+inline uint32_t negBytes(uint32_t a) {
+	return (ADJUST_BYTE_HIGH_BITS - (a & ~ADJUST_BYTE_HIGH_BITS)) ^ (~a & ADJUST_BYTE_HIGH_BITS);
+}
+
+inline uint8_t adjustByte(uint8_t op, uint8_t value, uint8_t operand, uint8_t & carry) {
+	switch (op) {
+		case ADJUST_NOT:		return ~value;
+		case ADJUST_NEG:		return -value;
+		case ADJUST_SET:		return operand;
+		case ADJUST_ADD:		return value + operand;
+		case ADJUST_ADD_CARRY: {
+			uint16_t sum = value + operand + carry;
+			carry = sum >> 8;
+			return sum;
+		}
+		case ADJUST_AND:		return value & operand;
+		case ADJUST_OR:			return value | operand;
+		case ADJUST_XOR:		return value ^ operand;
+	}
+	return value;
+}
+
+inline uint32_t adjustWord(uint8_t op, uint32_t value, uint32_t operand, uint8_t & carry) {
+	switch (op) {
+		case ADJUST_NOT:		return ~value;
+		case ADJUST_NEG:		return negBytes(value);
+		case ADJUST_SET:		return operand;
+		case ADJUST_ADD:		return addBytes(value, operand);
+		case ADJUST_ADD_CARRY: {
+			uint64_t sum = (uint64_t)value + operand + carry;
+			carry = sum >> 32;
+			return sum;
+		}
+		case ADJUST_AND:		return value & operand;
+		case ADJUST_OR:			return value | operand;
+		case ADJUST_XOR:		return value ^ operand;
+	}
+	return value;
+}
+
+// Adjust a span of bytes, using either a single operand value, or a span of operands
+// when operands is not null
+// Returns the carry out, for ADJUST_ADD_CARRY
+//
+uint8_t adjustSpan(uint8_t op, uint8_t * target, const uint8_t * operands, uint8_t operand, uint32_t length, uint8_t carry) {
+	uint32_t i = 0;
+	// bytes up to a word boundary
+	while (i < length && ((uintptr_t)(target + i) & 3)) {
+		target[i] = adjustByte(op, target[i], operands ? operands[i] : operand, carry);
+		i++;
+	}
+	// whole words
+	uint32_t operandWord = operand * 0x01010101;
+	for (; i + 4 <= length; i += 4) {
+		if (operands) {
+			memcpy(&operandWord, operands + i, 4);
+		}
+		auto word = (uint32_t *)(target + i);
+		*word = adjustWord(op, *word, operandWord, carry);
+	}
+	// and whatever is left
+	for (; i < length; i++) {
+		target[i] = adjustByte(op, target[i], operands ? operands[i] : operand, carry);
+	}
+	return carry;
+}
+
+#endif // BUFFER_ADJUST_H
@@ -0,0 +1,91 @@
+#ifndef BUFFER_ARGUMENTS_H
+#define BUFFER_ARGUMENTS_H
+
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+
+#include "types.h"
+
+// Where an argument is substituted into a buffer, when it's called with arguments
+//
+struct BufferParameter {
+	uint16_t	offset;
+	uint8_t		index;				// Argument to substitute
+	uint8_t		width;				// Bytes of it to substitute, low byte first
+};
+
+// The bytes a call's arguments replace in the buffer it calls
+// Streams reading the buffer check each byte's offset against these as they go,
+// so the buffer is never copied or changed
+// Bytes are kept in offset order, and reads usually move forwards through them,
+// so a byte is normally checked against just the next replacement
+//
+class BufferArguments {
+	public:
+		void set(const std::vector<BufferParameter> & parameters, const uint16_t * arguments, uint8_t count);
+		inline void clear() {
+			bytes.clear();
+			next = 0;
+		}
+
+		// Get the byte to read at an offset, given the buffer's own byte there
+		inline uint8_t apply(uint32_t offset, uint8_t value) {
+			if ((next < bytes.size() && bytes[next].offset < offset) || (next > 0 && bytes[next - 1].offset >= offset)) {
+				seek(offset);
+			}
+			if (next < bytes.size() && bytes[next].offset == offset) {
+				return bytes[next++].value;
+			}
+			return value;
+		}
+		// Replace bytes in a run read from an offset
+		inline void apply(uint32_t offset, uint8_t * data, size_t count) {
+			seek(offset);
+			while (next < bytes.size() && bytes[next].offset < offset + count) {
+				data[bytes[next].offset - offset] = bytes[next].value;
+				next++;
+			}
+		}
+
+	private:
+		struct Replacement {
+			uint32_t	offset;
+			uint8_t		value;
+		};
+
+		inline void seek(uint32_t offset) {
+			next = std::lower_bound(bytes.begin(), bytes.end(), offset,
+				[](const Replacement & r, uint32_t offset) { return r.offset < offset; }) - bytes.begin();
+		}
+
+		std::vector<Replacement, psram_allocator<Replacement>> bytes;	// Storage is kept from one call to the next
+		size_t next = 0;												// First replacement at or after the last offset read
+};
+
+// Work out the bytes replaced by a call's arguments
+// Parameters whose argument isn't given keep the buffer's own bytes, and where
+// parameters overlap the one set last wins
+//
+void BufferArguments::set(const std::vector<BufferParameter> & parameters, const uint16_t * arguments, uint8_t count) {
+	clear();
+	for (auto & parameter : parameters) {
+		if (parameter.index >= count) {
+			continue;
+		}
+		auto argument = arguments[parameter.index];
+		for (auto i = 0; i < parameter.width; i++) {
+			uint32_t offset = parameter.offset + i;
+			uint8_t value = argument >> (i * 8);
+			seek(offset);
+			if (next < bytes.size() && bytes[next].offset == offset) {
+				bytes[next].value = value;
+			} else {
+				bytes.insert(bytes.begin() + next, { offset, value });
+			}
+		}
+	}
+	next = 0;
+}
+
+#endif // BUFFER_ARGUMENTS_H
@@ -0,0 +1,273 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <stdint.h>
+
+#include "agon.h"
+#include "types.h"
+
+// Size-class pool for buffer blocks, and the objects that manage them
+// Small allocations are taken from slabs of BUFFER_POOL_SLAB_SIZE bytes, each holding items of a single
+// size class, so lots of small blocks share a few slabs rather than being scattered through PSRAM
+// A slab goes back to the heap as soon as its last item is freed, so clearing buffers returns whole slabs
+// Allocations bigger than the largest class come straight from the heap
+//
+// Each item is preceded by a pointer to its slab, so it can be freed without searching for it
+// Only used from the VDU task, so there's no locking
+//
+#define BUFFER_POOL_ALIGN		alignof(std::max_align_t)
+#define BUFFER_POOL_HEADER		((sizeof(void *) + BUFFER_POOL_ALIGN - 1) / BUFFER_POOL_ALIGN * BUFFER_POOL_ALIGN)
+
+struct PoolSlab {
+	PoolSlab *	next;
+	PoolSlab *	prev;
+	void *		freeList;			// Free items, linked through their first word
+	uint16_t	used;				// Items handed out
+	uint16_t	capacity;
+	uint8_t		sizeClass;
+};
+
+class BufferPool {
+	public:
+		void * allocate(size_t size);
+		void deallocate(void * item, size_t size);
+
+		static inline uint8_t classFor(size_t size) {
+			return size <= BUFFER_POOL_MIN_SIZE ? 0 : 32 - __builtin_clz(size - 1) - __builtin_ctz(BUFFER_POOL_MIN_SIZE);
+		}
+		static inline uint32_t classSize(uint8_t sizeClass) {
+			return BUFFER_POOL_MIN_SIZE << sizeClass;
+		}
+
+		// Statistics
+		inline uint16_t slabs(uint8_t sizeClass) {
+			return classes[sizeClass].slabs;
+		}
+		inline uint32_t itemsUsed(uint8_t sizeClass) {
+			return classes[sizeClass].itemsUsed;
+		}
+		uint32_t slabBytes();
+		inline uint32_t requestedBytes() {
+			return requested;
+		}
+		inline uint32_t largeBytes() {
+			return large;
+		}
+
+	private:
+		struct SizeClass {
+			PoolSlab *	partial = nullptr;	// Slabs with free items
+			PoolSlab *	full = nullptr;		// Slabs with none
+			uint16_t	slabs = 0;
+			uint32_t	itemsUsed = 0;
+		};
+
+		static inline uint32_t stride(uint8_t sizeClass) {
+			return BUFFER_POOL_HEADER + classSize(sizeClass);
+		}
+		static inline uint32_t slabHeader() {
+			return (sizeof(PoolSlab) + BUFFER_POOL_ALIGN - 1) / BUFFER_POOL_ALIGN * BUFFER_POOL_ALIGN;
+		}
+		PoolSlab * newSlab(uint8_t sizeClass);
+		void link(PoolSlab * & list, PoolSlab * slab);
+		void unlink(PoolSlab * & list, PoolSlab * slab);
+
+		SizeClass	classes[BUFFER_POOL_CLASSES];
+		uint32_t	requested = 0;			// Bytes asked for by items in slabs
+		uint32_t	large = 0;				// Bytes of allocations too big for a slab
+};
+
+BufferPool bufferPool;
+
+// Evicts the least recently used cacheable buffer (see vdu_buffered.h)
+bool evictCachedBuffer();
+
+// Allocate memory from the pool
+// Returns nullptr if it couldn't be allocated
+//
+void * BufferPool::allocate(size_t size) {
+	if (size > BUFFER_POOL_MAX_SIZE) {
+		auto item = PreferPSRAMAlloc(size);
+		if (item) {
+			large += size;
+		}
+		return item;
+	}
+	auto sizeClass = classFor(size);
+	auto & list = classes[sizeClass];
+	auto slab = list.partial;
+	if (!slab) {
+		slab = newSlab(sizeClass);
+		if (!slab) {
+			return nullptr;
+		}
+	}
+	auto item = slab->freeList;
+	slab->freeList = *(void **)item;
+	slab->used++;
+	if (slab->used == slab->capacity) {
+		unlink(list.partial, slab);
+		link(list.full, slab);
+	}
+	list.itemsUsed++;
+	requested += size;
+	return item;
+}
+
+// Return memory to the pool, with the size it was allocated with
+//
+void BufferPool::deallocate(void * item, size_t size) {
+	if (!item) {
+		return;
+	}
+	if (size > BUFFER_POOL_MAX_SIZE) {
+		large -= size;
+		free(item);
+		return;
+	}
+	auto slab = *(PoolSlab **)((uint8_t *)item - BUFFER_POOL_HEADER);
+	auto & list = classes[slab->sizeClass];
+	*(void **)item = slab->freeList;
+	slab->freeList = item;
+	if (slab->used == slab->capacity) {
+		unlink(list.full, slab);
+		link(list.partial, slab);
+	}
+	slab->used--;
+	list.itemsUsed--;
+	requested -= size;
+	if (slab->used == 0) {
+		unlink(list.partial, slab);
+		list.slabs--;
+		free(slab);
+	}
+}
+
+uint32_t BufferPool::slabBytes() {
+	uint32_t bytes = 0;
+	for (auto & sizeClass : classes) {
+		bytes += sizeClass.slabs * BUFFER_POOL_SLAB_SIZE;
+	}
+	return bytes;
+}
+
+// Allocate a slab for a size class, with all of its items free
+//
+PoolSlab * BufferPool::newSlab(uint8_t sizeClass) {
+	auto slab = (PoolSlab *)PreferPSRAMAlloc(BUFFER_POOL_SLAB_SIZE);
+	if (!slab) {
+		return nullptr;
+	}
+	slab->sizeClass = sizeClass;
+	slab->used = 0;
+	slab->capacity = (BUFFER_POOL_SLAB_SIZE - slabHeader()) / stride(sizeClass);
+	slab->freeList = nullptr;
+	// thread the free list through the items, first item first
+	auto base = (uint8_t *)slab + slabHeader();
+	for (auto i = slab->capacity; i > 0; i--) {
+		auto entry = base + (i - 1) * stride(sizeClass);
+		*(PoolSlab **)entry = slab;
+		auto item = entry + BUFFER_POOL_HEADER;
+		*(void **)item = slab->freeList;
+		slab->freeList = item;
+	}
+	link(classes[sizeClass].partial, slab);
+	classes[sizeClass].slabs++;
+	return slab;
+}
+
+void BufferPool::link(PoolSlab * & list, PoolSlab * slab) {
+	slab->prev = nullptr;
+	slab->next = list;
+	if (list) {
+		list->prev = slab;
+	}
+	list = slab;
+}
+
+void BufferPool::unlink(PoolSlab * & list, PoolSlab * slab) {
+	if (slab->prev) {
+		slab->prev->next = slab->next;
+	} else {
+		list = slab->next;
+	}
+	if (slab->next) {
+		slab->next->prev = slab->prev;
+	}
+}
+
+// pool_allocator
+//
+// A C++ allocator that allocates from the buffer pool, for use with std::allocate_shared,
+// so that a block's object and its control block come from the pool in one allocation
+// Cacheable buffers are evicted to make room if need be, and std::bad_alloc is thrown
+// if there still isn't any, as std::allocate_shared expects
+//
+template <typename T>
+class pool_allocator
+{
+public:
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef T value_type;
+
+	pool_allocator(){}
+	~pool_allocator(){}
+
+	template <class U> struct rebind { typedef pool_allocator<U> other; };
+	template <class U> pool_allocator(const pool_allocator<U>&){}
+
+	pointer allocate(size_type n, const void * hint = 0)
+	{
+		do {
+			auto p = bufferPool.allocate(n * sizeof(T));
+			if (p) {
+				return static_cast<pointer>(p);
+			}
+		} while (evictCachedBuffer());
+		throw std::bad_alloc();
+	}
+
+	void deallocate(pointer p, size_type n)
+	{
+		bufferPool.deallocate(p, n * sizeof(T));
+	}
+
+	template< class U, class... Args >
+	void construct( U* p, Args&&... args )
+	{
+		::new((void *) p ) U(std::forward<Args>(args)...);
+	}
+
+	template< class U >
+	void destroy(U* p)
+	{
+		p->~U();
+	}
+};
+
+// make_shared_pooled
+//
+// Same as make_shared_psram, except the object comes from the buffer pool
+// Returns nullptr if the object couldn't be allocated
+
+template<typename T, typename... Args>
+std::shared_ptr<T> make_shared_pooled(Args&&... args)
+{
+	pool_allocator<T> allocator;
+	try {
+		return std::allocate_shared<T>(allocator, std::forward<Args>(args)...);
+	} catch (std::bad_alloc &) {
+		debug_log("make_shared_pooled: out of memory\n\r");
+		return nullptr;
+	}
+}
+
+#endif // BUFFER_POOL_H
@@ -0,0 +1,38 @@
+#ifndef BUFFER_REGISTERS_H
+#define BUFFER_REGISTERS_H
+
+#include <stdint.h>
+
+#include "agon.h"
+
+// Registers for buffered programs
+// These are shared by every buffer, so one buffer can leave a value for another to pick up,
+// and hold 32-bit values that can be worked on without looking up a buffer at all
+//
+uint32_t bufferRegisters[BUFFER_REGISTERS];
+
+// Width of buffer values and immediate operands for a register operation
+//
+inline uint8_t registerWidth(uint8_t command) {
+	return (command & REG_32BIT) ? 4 : (command & REG_16BIT) ? 2 : 1;
+}
+
+// Apply an operation to a register's value
+// Load and store don't change the value, so they're handled by the caller
+//
+inline uint32_t registerOp(uint8_t op, uint32_t value, uint32_t operand) {
+	switch (op) {
+		case REG_SET:			return operand;
+		case REG_ADD:			return value + operand;
+		case REG_SUB:			return value - operand;
+		case REG_MUL:			return value * operand;
+		case REG_AND:			return value & operand;
+		case REG_OR:			return value | operand;
+		case REG_XOR:			return value ^ operand;
+		case REG_SHIFT_LEFT:	return operand < 32 ? value << operand : 0;
+		case REG_SHIFT_RIGHT:	return operand < 32 ? value >> operand : 0;
+	}
+	return value;
+}
+
+#endif // BUFFER_REGISTERS_H
@@ -4,14 +4,28 @@
 #include <memory>
 #include <Stream.h>
 
+#include "buffer_pool.h"
 #include "types.h"
 
+// A block of buffer data
+// Copies of a block share its contents until either of them changes them, at which point
+// the one being changed takes a copy of its own, so anything that writes to a block
+// must do so through getWritableBuffer (or the write methods, which use it)
+// Slices of a block work the same way, sharing just part of its contents
+//
 class BufferStream : public Stream {
 	public:
 		BufferStream(uint32_t bufferLength);
+		BufferStream(std::shared_ptr<uint8_t> contents, uint32_t bufferLength);
+		BufferStream(const BufferStream & source);
+		BufferStream(const BufferStream & source, uint32_t offset, uint32_t length);
 		int available();
 		int read();
 		int peek();
+		size_t readBytes(uint8_t * data, size_t length);
+		size_t readBytes(char * data, size_t length) {
+			return readBytes((uint8_t *)data, length);
+		}
 		size_t write(uint8_t b);
 		virtual bool isWritable() {
 			return false;
@@ -26,22 +40,179 @@ class BufferStream : public Stream {
 		}
 
 		inline uint8_t * getBuffer() {
-			return buffer.get();
+			return buffer.get() + bufferOffset;
+		}
+		uint8_t * getWritableBuffer();
+		uint8_t * getPinnedBuffer();
+		std::shared_ptr<BufferStream> share();
+		std::shared_ptr<BufferStream> slice(uint32_t offset, uint32_t length);
+		inline bool isShared() {
+			return buffer.use_count() > 1;
+		}
+		inline bool isSlice() {
+			return bufferOffset != 0 || bufferLength != storageLength;
 		}
 		inline uint32_t size() {
 			return bufferLength;
 		}
 		bool writeBuffer(uint8_t * data, uint32_t length, uint32_t offset);
-		void writeBufferByte(uint8_t data, uint32_t offset);
+		bool writeBufferByte(uint8_t data, uint32_t offset);
 		bool incrementBufferByte(uint32_t offset, int8_t by);
+
+		// Anything that changes the contents of a buffer must mark it as changed,
+		// so that caches built from it (such as decoded buffers) can tell they are out of date
+		inline void markChanged() {
+			version++;
+			changes++;
+		}
+		inline uint32_t getVersion() {
+			return version;
+		}
+		static uint32_t changes;			// Number of changes made to any buffer
+
 	protected:
-		std::unique_ptr<uint8_t[]> buffer;
+		bool unshare();
+
+		std::shared_ptr<uint8_t> buffer;	// Contents, which may be shared with copies of this block
+		uint32_t bufferOffset = 0;			// Start of our contents within buffer, for slices
+		uint32_t storageLength;				// Size of buffer, which is bigger than ours for slices
 		uint32_t bufferLength;
 		uint32_t bufferPosition;
+		uint32_t version = 0;				// Number of changes made to this buffer
+		bool pinned = false;				// Something holds a pointer to our contents, so they can't be shared
 };
 
-BufferStream::BufferStream(uint32_t bufferLength) : bufferLength(bufferLength), bufferPosition(0) {
-	buffer = make_unique_psram_array<uint8_t>(bufferLength);
+uint32_t BufferStream::changes = 0;
+
+// Block contents are counted for as long as they exist, and can be limited to a quota
+// When an allocation would go over the quota, or PSRAM runs out, cacheable buffers are evicted to make room
+//
+uint32_t bufferDataBytes = 0;			// Bytes of block contents currently allocated
+uint32_t bufferDataQuota = 0;			// Limit on bufferDataBytes, or 0 for no limit
+
+struct BufferDataDeleter {
+	uint32_t length;
+	void operator()(uint8_t * data) {
+		bufferDataBytes -= length;
+		bufferPool.deallocate(data, length);
+	}
+};
+
+// Allocate contents for a block, evicting cacheable buffers if there isn't room
+// Returns nullptr if there still isn't room once nothing more can be evicted
+//
+inline std::shared_ptr<uint8_t> allocateBufferData(uint32_t length) {
+	do {
+		if (bufferDataQuota == 0 || bufferDataBytes + length <= bufferDataQuota) {
+			auto data = (uint8_t *)bufferPool.allocate(length);
+			if (data) {
+				bufferDataBytes += length;
+				try {
+					return std::shared_ptr<uint8_t>(data, BufferDataDeleter { length }, pool_allocator<uint8_t>());
+				} catch (std::bad_alloc &) {
+					// no room for the control block, which has already freed the data
+					break;
+				}
+			}
+		}
+	} while (evictCachedBuffer());
+	debug_log("allocateBufferData: no room for %d bytes\n\r", length);
+	return nullptr;
+}
+
+// Allocate contents for a block that isn't held in a buffer, such as a frame being received
+// These aren't counted against the buffer quota, so allocating them never evicts a buffer
+//
+inline std::shared_ptr<uint8_t> allocateStagingData(uint32_t length) {
+	return std::shared_ptr<uint8_t>((uint8_t *)PreferPSRAMAlloc(length), free);
+}
+
+BufferStream::BufferStream(uint32_t bufferLength) : storageLength(bufferLength), bufferLength(bufferLength), bufferPosition(0) {
+	buffer = allocateBufferData(bufferLength);
+}
+
+// Make a block around contents that have already been allocated
+//
+BufferStream::BufferStream(std::shared_ptr<uint8_t> contents, uint32_t bufferLength) : buffer(contents),
+	storageLength(bufferLength), bufferLength(bufferLength), bufferPosition(0) {}
+
+// Make a staging block, whose contents come from allocateStagingData
+//
+inline std::shared_ptr<BufferStream> makeStagingStream(uint32_t length) {
+	return make_shared_psram<BufferStream>(allocateStagingData(length), length);
+}
+
+// Copy a block, sharing its contents
+//
+BufferStream::BufferStream(const BufferStream & source) : buffer(source.buffer), bufferOffset(source.bufferOffset),
+	storageLength(source.storageLength), bufferLength(source.bufferLength), bufferPosition(0) {}
+
+// Slice a block, sharing the given part of its contents
+//
+BufferStream::BufferStream(const BufferStream & source, uint32_t offset, uint32_t length) : buffer(source.buffer),
+	bufferOffset(source.bufferOffset + offset), storageLength(source.storageLength), bufferLength(length), bufferPosition(0) {}
+
+// Get our contents in order to change them, first taking our own copy of them if they're shared
+// Returns nullptr if a copy was needed but couldn't be allocated
+//
+uint8_t * BufferStream::getWritableBuffer() {
+	if (isShared() && !unshare()) {
+		return nullptr;
+	}
+	markChanged();
+	return getBuffer();
+}
+
+// Get our contents for something that will keep a pointer to them, such as a bitmap
+// They're never shared from then on, so changes made through this block are always
+// seen through the pointer, and the pointer stays valid for as long as the block exists
+// Slices always take their own copy, so a bitmap made from a slice doesn't keep all of its parent's contents
+// Returns nullptr if a copy was needed but couldn't be allocated
+//
+uint8_t * BufferStream::getPinnedBuffer() {
+	if ((isShared() || isSlice()) && !unshare()) {
+		return nullptr;
+	}
+	pinned = true;
+	return getBuffer();
+}
+
+// Make a copy of this block, sharing our contents unless they're pinned
+// Returns nullptr if the copy couldn't be allocated
+//
+std::shared_ptr<BufferStream> BufferStream::share() {
+	auto copy = make_shared_pooled<BufferStream>(*this);
+	if (!copy || (pinned && !copy->unshare())) {
+		return nullptr;
+	}
+	return copy;
+}
+
+// Make a block from part of this one, sharing our contents unless they're pinned
+// The part must lie within this block
+// Returns nullptr if the slice couldn't be allocated
+//
+std::shared_ptr<BufferStream> BufferStream::slice(uint32_t offset, uint32_t length) {
+	auto part = make_shared_pooled<BufferStream>(*this, offset, length);
+	if (!part || (pinned && !part->unshare())) {
+		return nullptr;
+	}
+	return part;
+}
+
+// Take our own copy of our contents
+//
+bool BufferStream::unshare() {
+	auto data = allocateBufferData(bufferLength);
+	if (!data.get()) {
+		debug_log("BufferStream::unshare: failed to allocate %d bytes\n\r", bufferLength);
+		return false;
+	}
+	memcpy(data.get(), getBuffer(), bufferLength);
+	buffer = data;
+	bufferOffset = 0;
+	storageLength = bufferLength;
+	return true;
 }
 
 int BufferStream::available() {
@@ -50,18 +221,30 @@ int BufferStream::available() {
 
 int BufferStream::read() {
 	if (bufferPosition < bufferLength) {
-		return buffer[bufferPosition++];
+		return getBuffer()[bufferPosition++];
 	}
 	return -1;
 }
 
 int BufferStream::peek() {
 	if (bufferPosition < bufferLength) {
-		return buffer[bufferPosition];
+		return getBuffer()[bufferPosition];
 	}
 	return -1;
 }
 
+// Bulk read from the buffer, returning the number of bytes copied
+//
+size_t BufferStream::readBytes(uint8_t * data, size_t length) {
+	auto remaining = bufferLength - bufferPosition;
+	if (length > remaining) {
+		length = remaining;
+	}
+	memcpy(data, getBuffer() + bufferPosition, length);
+	bufferPosition += length;
+	return length;
+}
+
 size_t BufferStream::write(uint8_t b) {
 	// write is not supported
 	return 0;
@@ -71,7 +254,11 @@ bool BufferStream::writeBuffer(uint8_t * data, uint32_t length, uint32_t offset
 	// TODO consider return type - we could support writing to buffer limit,
 	// and returning how many bytes were written
 	if (length + offset <= bufferLength) {
-		memcpy(buffer.get() + offset, data, length);
+		auto target = getWritableBuffer();
+		if (!target) {
+			return false;
+		}
+		memcpy(target + offset, data, length);
 		return true;
 	} else {
 		debug_log("BufferStream::writeBuffer: buffer overflow\n\r");
@@ -79,25 +266,31 @@ bool BufferStream::writeBuffer(uint8_t * data, uint32_t length, uint32_t offset
 	}
 }
 
-void BufferStream::writeBufferByte(uint8_t data, uint32_t offset = 0) {
-	if (offset < bufferLength) {
-		buffer[offset] = data;
+// Returns false if the offset is out of range, or our contents couldn't be copied to change them
+//
+bool BufferStream::writeBufferByte(uint8_t data, uint32_t offset = 0) {
+	auto target = offset < bufferLength ? getWritableBuffer() : nullptr;
+	if (!target) {
+		return false;
 	}
+	target[offset] = data;
+	return true;
 }
 
 // incrementBufferByte
 // accepts an offset and a value to increment by
 // returns true if value overflowed
 bool BufferStream::incrementBufferByte(uint32_t offset = 0, int8_t by = 1) {
-	if (offset < bufferLength) {
-		auto oldValue = buffer[offset];
-		buffer[offset] += by;
+	auto target = offset < bufferLength ? getWritableBuffer() : nullptr;
+	if (target) {
+		auto oldValue = target[offset];
+		target[offset] += by;
 
 		// check for overflow
 		if (by > 0) {
-			return buffer[offset] < oldValue;
+			return target[offset] < oldValue;
 		} else {
-			return buffer[offset] > oldValue;
+			return target[offset] > oldValue;
 		}
 	}
 	return false;
@@ -121,8 +314,9 @@ class WritableBufferStream : public BufferStream {
 };
 
 size_t WritableBufferStream::write(uint8_t b) {
-	if (bufferWritePosition < bufferLength) {
-		buffer[bufferWritePosition++] = b;
+	auto target = bufferWritePosition < bufferLength ? getWritableBuffer() : nullptr;
+	if (target) {
+		target[bufferWritePosition++] = b;
 		return 1;
 	}
 	debug_log("WritableBufferStream::write: buffer overflow\n\r");
@@ -1,13 +1,134 @@
 #ifndef BUFFERS_H
 #define BUFFERS_H
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 #include <unordered_map>
 
+#include "buffer_arguments.h"
 #include "buffer_stream.h"
+#include "id_table.h"
 
-std::unordered_map<uint16_t, std::vector<std::shared_ptr<BufferStream>>> buffers;
+uint32_t bufferClock = 0;			// Advanced by each buffered command, to tell which buffers were used most recently
+
+// The blocks stored against a buffer ID
+// Keeps an index of where each block starts, so that finding the block holding an offset
+// is a binary search, or a single check when it's in the same block as the last one found
+// The index is rebuilt the next time it's needed after the list of blocks changes
+//
+// Buffers also note when they were last used, so cacheable ones can be evicted least recently used first
+// Anything that works on a buffer's blocks, and may allocate while doing so, must touch it first,
+// as buffers used by the current command are never evicted
+//
+class BufferBlocks : public std::vector<std::shared_ptr<BufferStream>> {
+	public:
+		void push_back(const std::shared_ptr<BufferStream> & block) {
+			changed();
+			touch();
+			vector::push_back(block);
+		}
+		void push_back(std::shared_ptr<BufferStream> && block) {
+			changed();
+			touch();
+			vector::push_back(std::move(block));
+		}
+		void clear() {
+			changed();
+			vector::clear();
+		}
+		// Must be called after changing the list of blocks in any other way, such as reordering them
+		inline void changed() {
+			indexed = false;
+		}
+		inline void touch() {
+			lastUsed = bufferClock;
+		}
+		inline bool inUse() {
+			return lastUsed == bufferClock;
+		}
+		inline uint32_t bytes() {
+			return blockStart(size());
+		}
+
+		bool find(uint32_t offset, size_t & index, uint32_t & blockOffset);
+		uint32_t blockStart(size_t index);
+
+		uint32_t lastUsed = 0;				// Value of bufferClock when this was last used
+		bool cacheable = false;				// Can be evicted to make room for other buffers
+		std::vector<BufferParameter> parameters;	// Where arguments go when this is called with them
+
+	private:
+		void buildIndex();
+
+		std::vector<uint32_t> starts;		// Offset of the start of each block, plus the total size
+		size_t lastIndex = 0;				// Block found by the last search
+		bool indexed = false;
+};
+
+// Find the block holding an offset
+// Returns:
+// - true with the block's index and the offset within it, or false if the offset is past the end
+//
+bool BufferBlocks::find(uint32_t offset, size_t & index, uint32_t & blockOffset) {
+	if (!indexed) {
+		buildIndex();
+	}
+	if (offset >= starts.back()) {
+		return false;
+	}
+	if (offset < starts[lastIndex] || offset >= starts[lastIndex + 1]) {
+		// the last element is the total size, so upper_bound always finds the block
+		lastIndex = std::upper_bound(starts.begin(), starts.end(), offset) - starts.begin() - 1;
+	}
+	index = lastIndex;
+	blockOffset = offset - starts[lastIndex];
+	return true;
+}
+
+// Get the offset of the start of a block
+//
+uint32_t BufferBlocks::blockStart(size_t index) {
+	if (!indexed) {
+		buildIndex();
+	}
+	return starts[std::min(index, size())];
+}
+
+void BufferBlocks::buildIndex() {
+	starts.resize(size() + 1);
+	uint32_t offset = 0;
+	for (size_t i = 0; i < size(); i++) {
+		starts[i] = offset;
+		offset += (*this)[i]->size();
+	}
+	starts[size()] = offset;
+	lastIndex = 0;
+	indexed = true;
+}
+
+IdTable<BufferBlocks> buffers;
+
+std::vector<uint16_t> evictedBuffers;	// Buffers evicted that the host hasn't been told about yet
+uint32_t bufferEvictions = 0;			// Number of buffers evicted
+
+// Mark a buffer as used, if it exists
+//
+inline void touchBuffer(uint16_t bufferId) {
+	auto buffer = buffers.find(bufferId);
+	if (buffer != buffers.end()) {
+		buffer->second.touch();
+	}
+}
+
+// A large buffer write that hasn't completed yet
+// The block is only added to its buffer once all of it has been received
+struct PendingWrite {
+	std::shared_ptr<BufferStream> stream;
+	uint32_t received;				// Bytes received, from the start of the block
+};
+
+std::unordered_map<uint16_t, PendingWrite> pendingWrites;
 
 // Utility functions for buffer management:
 
@@ -31,14 +152,14 @@ void reverseValues(uint8_t * data, uint32_t length, uint8_t valueSize) {
 
 	if (valueSize == 1) {
 		// reverse the data
-		for (auto i = 0; i <= (bufferEnd / 2); i++) {
+		for (uint32_t i = 0; i <= (bufferEnd / 2); i++) {
 			auto temp = data[i];
 			data[i] = data[bufferEnd - i];
 			data[bufferEnd - i] = temp;
 		}
 	} else {
 		// reverse the data in chunks
-		for (auto i = 0; i <= (bufferEnd / (valueSize * 2)); i++) {
+		for (uint32_t i = 0; i <= (bufferEnd / (valueSize * 2)); i++) {
 			auto sourceOffset = i * valueSize;
 			auto targetOffset = bufferEnd - sourceOffset;
 			for (auto j = 0; j < valueSize; j++) {
@@ -50,6 +171,23 @@ void reverseValues(uint8_t * data, uint32_t length, uint8_t valueSize) {
 	}
 }
 
+// Compare two values with a conditional operation
+bool compareValues(uint8_t op, int64_t value, int64_t operand) {
+	switch (op) {
+		case COND_EXISTS:			return value != 0;
+		case COND_NOT_EXISTS:		return value == 0;
+		case COND_EQUAL:			return value == operand;
+		case COND_NOT_EQUAL:		return value != operand;
+		case COND_LESS:				return value < operand;
+		case COND_GREATER:			return value > operand;
+		case COND_LESS_EQUAL:		return value <= operand;
+		case COND_GREATER_EQUAL:	return value >= operand;
+		case COND_AND:				return value && operand;
+		case COND_OR:				return value || operand;
+	}
+	return false;
+}
+
 // Work out which buffer to use next
 void updateTarget(std::vector<uint16_t> targets, uint16_t &target, uint16_t &index, bool iterate) {
 	if (iterate) {
@@ -68,17 +206,21 @@ void updateTarget(std::vector<uint16_t> targets, uint16_t &target, uint16_t &ind
 }
 
 // consolidate blocks/streams into a single buffer
-std::shared_ptr<BufferStream> consolidateBuffers(std::vector<std::shared_ptr<BufferStream>>& streams) {
+// a staging buffer (see makeStagingStream) is used if staging is set
+std::shared_ptr<BufferStream> consolidateBuffers(std::vector<std::shared_ptr<BufferStream>>& bufferStreams, bool staging = false) {
 	// don't do anything if only one stream
-	if (streams.size() == 1) {
-		return streams[0];
+	if (bufferStreams.size() == 1) {
+		return bufferStreams[0];
 	}
+	// allocating can evict buffers, which could be the one these blocks belong to,
+	// so hold on to the blocks themselves rather than the buffer's list of them
+	auto streams = bufferStreams;
 	// work out total length of buffer
 	uint32_t length = 0;
 	for (auto block : streams) {
 		length += block->size();
 	}
-	auto bufferStream = make_shared_psram<BufferStream>(length);
+	auto bufferStream = staging ? makeStagingStream(length) : make_shared_pooled<BufferStream>(length);
 	if (!bufferStream || !bufferStream->getBuffer()) {
 		// buffer couldn't be created
 		return nullptr;
@@ -92,31 +234,153 @@ std::shared_ptr<BufferStream> consolidateBuffers(std::vector<std::shared_ptr<Buf
 	return bufferStream;
 }
 
+// Get a block holding part of a buffer
+// Parts that lie within a single block are slices of it, sharing its contents,
+// and only parts that span blocks are copied
+// Returns nullptr if the block couldn't be created, or the part runs past the end of the buffer
+//
+std::shared_ptr<BufferStream> sliceBlocks(BufferBlocks & blocks, uint32_t offset, uint32_t length) {
+	size_t index;
+	uint32_t blockOffset;
+	if (!blocks.find(offset, index, blockOffset) || offset + length > blocks.bytes()) {
+		return nullptr;
+	}
+	auto & block = blocks[index];
+	if (blockOffset + length <= block->size()) {
+		if (blockOffset == 0 && length == block->size()) {
+			return block->share();
+		}
+		return block->slice(blockOffset, length);
+	}
+	auto part = make_shared_pooled<BufferStream>(length);
+	if (!part || !part->getBuffer()) {
+		return nullptr;
+	}
+	auto data = part->getBuffer();
+	uint32_t copied = 0;
+	while (copied < length) {
+		auto & source = blocks[index++];
+		auto count = std::min(source->size() - blockOffset, length - copied);
+		memcpy(data + copied, source->getBuffer() + blockOffset, count);
+		copied += count;
+		blockOffset = 0;
+	}
+	return part;
+}
+
 // split a buffer into multiple blocks/chunks
-std::vector<std::shared_ptr<BufferStream>> splitBuffer(std::shared_ptr<BufferStream> buffer, uint16_t length) {
+// chunks are slices of the buffer's blocks where possible, so take no copies of its data
+std::vector<std::shared_ptr<BufferStream>> splitBuffer(BufferBlocks & blocks, uint16_t length) {
 	std::vector<std::shared_ptr<BufferStream>> chunks;
-	auto totalLength = buffer->size();
-	auto remaining = totalLength;
-	auto sourceData = buffer->getBuffer();
-
-	// chop up source data by length, storing into new buffers
-	// looping the buffer list until we have no data left
-	while (remaining > 0) {
-		auto bufferLength = length;
-		if (remaining < bufferLength) {
-			bufferLength = remaining;
-		}
-		auto chunk = make_shared_psram<BufferStream>(bufferLength);
-		if (!chunk || !chunk->getBuffer()) {
+	auto totalLength = blocks.bytes();
+	if (length == 0) {
+		return chunks;
+	}
+
+	// chop up source data by length, looping until we have no data left
+	for (uint32_t offset = 0; offset < totalLength; offset += length) {
+		auto chunk = sliceBlocks(blocks, offset, std::min<uint32_t>(length, totalLength - offset));
+		if (!chunk) {
 			// buffer couldn't be created, so return an empty vector
 			return {};
 		}
-		memcpy(chunk->getBuffer(), sourceData, bufferLength);
 		chunks.push_back(chunk);
-		sourceData += bufferLength;
-		remaining -= bufferLength;
 	}
 	return chunks;
 }
 
+// Reads through a buffer's blocks in order, copying out as much of a block as it can at a time
+//
+struct BlockReader {
+	BlockReader(BufferBlocks & blocks) : blocks(blocks), remaining(blocks.bytes()) {}
+
+	// Copy up to length bytes, returning the number copied
+	uint32_t read(uint8_t * data, uint32_t length) {
+		length = std::min(length, remaining);
+		uint32_t copied = 0;
+		while (copied < length) {
+			auto & block = blocks[index];
+			auto count = std::min(block->size() - offset, length - copied);
+			memcpy(data + copied, block->getBuffer() + offset, count);
+			copied += count;
+			offset += count;
+			if (offset == block->size()) {
+				index++;
+				offset = 0;
+			}
+		}
+		remaining -= length;
+		return length;
+	}
+
+	BufferBlocks & blocks;
+	size_t index = 0;					// Block being read
+	uint32_t offset = 0;				// Position within that block
+	uint32_t remaining;					// Bytes left to read
+};
+
+// De-interleave a buffer into separate blocks, in a single pass over its data
+// Chunks of width bytes are dealt out to the blocks in turn, so block n gets chunks n, n + count, n + count * 2 ...
+// Each block is allocated at its final size up front, and chunks are copied straight into place
+// Returns an empty vector if the blocks couldn't be created
+//
+std::vector<std::shared_ptr<BufferStream>> deinterleaveBuffer(BufferBlocks & blocks, uint16_t width, uint16_t count) {
+	std::vector<std::shared_ptr<BufferStream>> targets;
+	auto totalLength = blocks.bytes();
+	if (width == 0 || count == 0 || totalLength == 0) {
+		return targets;
+	}
+	// work out how much each block gets: a chunk for every whole row, plus whatever's left in the last one
+	uint32_t rowLength = width * count;
+	auto rows = totalLength / rowLength;
+	auto lastRow = totalLength % rowLength;
+	std::vector<uint8_t *> outputs;
+	for (uint32_t i = 0; i < count; i++) {
+		auto start = i * width;
+		auto extra = lastRow > start ? std::min<uint32_t>(lastRow - start, width) : 0;
+		auto target = make_shared_pooled<BufferStream>(rows * width + extra);
+		if (!target || !target->getBuffer()) {
+			return {};
+		}
+		targets.push_back(target);
+		outputs.push_back(target->getBuffer());
+	}
+	BlockReader reader(blocks);
+	while (reader.remaining > 0) {
+		for (auto & output : outputs) {
+			output += reader.read(output, width);
+		}
+	}
+	return targets;
+}
+
+// Interleave buffers into a single block, in a single pass over their data
+// Takes chunks of width bytes from each buffer in turn, skipping buffers once they run out,
+// which reverses deinterleaveBuffer
+// Returns nullptr if the block couldn't be created
+//
+std::shared_ptr<BufferStream> interleaveBuffers(std::vector<BufferBlocks *> & sources, uint16_t width) {
+	if (width == 0) {
+		return nullptr;
+	}
+	uint32_t totalLength = 0;
+	std::vector<BlockReader> readers;
+	for (auto source : sources) {
+		readers.emplace_back(*source);
+		totalLength += readers.back().remaining;
+	}
+	auto target = make_shared_pooled<BufferStream>(totalLength);
+	if (!target || !target->getBuffer()) {
+		return nullptr;
+	}
+	auto output = target->getBuffer();
+	auto end = output + totalLength;
+	while (output < end) {
+		for (auto & reader : readers) {
+			output += reader.read(output, width);
+		}
+	}
+	return target;
+}
+
 #endif // BUFFERS_H
@@ -0,0 +1,214 @@
+#ifndef DECODED_BUFFER_H
+#define DECODED_BUFFER_H
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <Stream.h>
+
+#include "agon.h"
+#include "buffer_arguments.h"
+#include "buffers.h"
+#include "buffer_stream.h"
+#include "types.h"
+
+// A buffer's contents as one flat block, kept so that calls of the buffer can run straight from it
+// rather than finding their way through its blocks a byte at a time
+// Commands are parsed as they're run, just as they are from the blocks, so call arguments
+// and changes the buffer makes to itself are seen in the same way
+//
+class DecodedBuffer {
+	public:
+		DecodedBuffer(std::vector<std::shared_ptr<BufferStream>> & blocks, std::shared_ptr<BufferStream> data);
+		bool isUnchanged();
+		bool isCurrent(std::vector<std::shared_ptr<BufferStream>> & blocks);
+
+		inline std::vector<std::shared_ptr<BufferStream>> & getBlocks() {
+			return blocks;
+		}
+
+		inline const uint8_t * getData() {
+			return data->getBuffer();
+		}
+		inline uint32_t size() {
+			return data->size();
+		}
+
+	private:
+		std::vector<std::shared_ptr<BufferStream>> blocks;		// The blocks this was made from
+		std::vector<uint32_t> versions;							// and their versions at the time
+		std::shared_ptr<BufferStream> data;						// The blocks' contents, consolidated
+};
+
+DecodedBuffer::DecodedBuffer(std::vector<std::shared_ptr<BufferStream>> & blocks, std::shared_ptr<BufferStream> data) : blocks(blocks), data(data) {
+	for (auto & block : blocks) {
+		versions.push_back(block->getVersion());
+	}
+}
+
+// Check whether the contents of the blocks this was made from are unchanged
+//
+bool DecodedBuffer::isUnchanged() {
+	for (size_t i = 0; i < blocks.size(); i++) {
+		if (blocks[i]->getVersion() != versions[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Check whether a buffer still holds the blocks this was made from, unchanged
+//
+bool DecodedBuffer::isCurrent(std::vector<std::shared_ptr<BufferStream>> & current) {
+	if (current.size() != blocks.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < blocks.size(); i++) {
+		if (current[i] != blocks[i]) {
+			return false;
+		}
+	}
+	return isUnchanged();
+}
+
+// Decoded buffers, by buffer ID
+//
+std::unordered_map<uint16_t, std::shared_ptr<DecodedBuffer>> decodedBuffers;
+
+// Get the decoded version of a buffer, decoding it if necessary
+// Returns nullptr if the buffer can't be decoded, for example because it's writable,
+// in which case it should be run the usual way
+//
+std::shared_ptr<DecodedBuffer> getDecodedBuffer(uint16_t bufferId) {
+	auto buffer = buffers.find(bufferId);
+	if (buffer == buffers.end() || buffer->second.empty()) {
+		return nullptr;
+	}
+	auto & blocks = buffer->second;
+	// mark the buffer as in use before anything is allocated, so it can't be evicted to make room
+	blocks.touch();
+	auto cached = decodedBuffers.find(bufferId);
+	if (cached != decodedBuffers.end()) {
+		if (cached->second->isCurrent(blocks)) {
+			return cached->second;
+		}
+		decodedBuffers.erase(cached);
+	}
+	for (auto & block : blocks) {
+		// output can be redirected into writable buffers, so they can change at any time
+		if (block->isWritable()) {
+			return nullptr;
+		}
+	}
+	if (blocks.size() > 1) {
+		// the decoded version is a consolidated copy of the blocks, so don't make one for big buffers
+		uint32_t length = 0;
+		for (auto & block : blocks) {
+			length += block->size();
+		}
+		if (length > DECODED_BUFFER_MAX_COPY) {
+			return nullptr;
+		}
+	}
+	// the flat copy is a cache rather than buffer data, so it's kept outside the buffer quota
+	auto data = consolidateBuffers(blocks, true);
+	if (!data || !data->getBuffer()) {
+		return nullptr;
+	}
+	auto decoded = make_shared_psram<DecodedBuffer>(blocks, data);
+	decodedBuffers[bufferId] = decoded;
+	return decoded;
+}
+
+// Drop the decoded version of a buffer, or all of them for buffer 65535
+// Calls already running it keep their own reference, just as they would keep the buffer's old blocks
+//
+void invalidateDecodedBuffer(uint16_t bufferId) {
+	if (bufferId == 65535) {
+		decodedBuffers.clear();
+		return;
+	}
+	decodedBuffers.erase(bufferId);
+}
+
+// A stream over a decoded buffer's data, with its own read position
+// The data is found through the decoded buffer on each read, rather than kept as a pointer,
+// as a command that writes to a single block buffer can give the block new contents
+//
+class DecodedBufferStream : public Stream {
+	public:
+		DecodedBufferStream() {}
+		DecodedBufferStream(std::shared_ptr<DecodedBuffer> decoded) {
+			begin(decoded);
+		}
+		void begin(std::shared_ptr<DecodedBuffer> buffer, BufferArguments * bufferArguments = nullptr) {
+			decoded = buffer;
+			length = buffer->size();
+			position = 0;
+			arguments = bufferArguments;
+		}
+		void end() {
+			decoded = nullptr;
+			length = 0;
+			position = 0;
+			arguments = nullptr;
+		}
+		// Arguments substituted into the data as it's read, if any
+		inline BufferArguments * getArguments() {
+			return arguments;
+		}
+		int available() {
+			return length - position;
+		}
+		int read() {
+			if (position >= length) {
+				return -1;
+			}
+			auto b = decoded->getData()[position];
+			if (arguments) {
+				b = arguments->apply(position, b);
+			}
+			position++;
+			return b;
+		}
+		int peek() {
+			if (position >= length) {
+				return -1;
+			}
+			auto b = decoded->getData()[position];
+			return arguments ? arguments->apply(position, b) : b;
+		}
+		size_t readBytes(uint8_t * buffer, size_t count) {
+			count = std::min<size_t>(count, length - position);
+			memcpy(buffer, decoded->getData() + position, count);
+			if (arguments) {
+				arguments->apply(position, buffer, count);
+			}
+			position += count;
+			return count;
+		}
+		size_t readBytes(char * buffer, size_t count) {
+			return readBytes((uint8_t *)buffer, count);
+		}
+		size_t write(uint8_t b) {
+			// write is not supported
+			return 0;
+		}
+		void seekTo(uint32_t offset) {
+			position = std::min(offset, length);
+		}
+		inline uint32_t tell() {
+			return position;
+		}
+
+		std::shared_ptr<DecodedBuffer> decoded;
+
+	private:
+		uint32_t length = 0;
+		uint32_t position = 0;
+		BufferArguments * arguments = nullptr;
+};
+
+#endif // DECODED_BUFFER_H
@@ -0,0 +1,178 @@
+#ifndef ID_TABLE_H
+#define ID_TABLE_H
+
+#include <memory>
+#include <utility>
+#include <stdint.h>
+
+#include "types.h"
+
+#define ID_TABLE_PAGE_SIZE		256						// IDs per page
+#define ID_TABLE_PAGES			(65536 / ID_TABLE_PAGE_SIZE)
+
+// A table of values indexed directly by a 16-bit ID
+// IDs are split into pages, each allocated the first time an ID in it is used,
+// so a lookup is just two array indexes, and memory is only used for the ranges of IDs in use
+// Each table costs ID_TABLE_PAGES pointers, plus ID_TABLE_PAGE_SIZE entries for each page in use
+// Pages are kept until the table is cleared, so entries never move
+//
+// The interface follows std::unordered_map, so lookups return an iterator to an ID/value pair
+// Iteration is in ID order
+//
+template<typename T>
+class IdTable {
+	public:
+		typedef std::pair<uint16_t, T> value_type;
+
+		class iterator {
+			public:
+				iterator(IdTable * table, uint32_t id) : table(table), id(id) {}
+				value_type & operator*() {
+					return table->entry(id);
+				}
+				value_type * operator->() {
+					return &table->entry(id);
+				}
+				iterator & operator++() {
+					id = table->next(id + 1);
+					return *this;
+				}
+				bool operator==(const iterator & other) const {
+					return id == other.id;
+				}
+				bool operator!=(const iterator & other) const {
+					return id != other.id;
+				}
+
+			private:
+				IdTable *	table;
+				uint32_t	id;
+		};
+
+		iterator begin() {
+			return iterator(this, next(0));
+		}
+		iterator end() {
+			return iterator(this, 65536);
+		}
+		iterator find(uint16_t id) {
+			auto & page = pages[id / ID_TABLE_PAGE_SIZE];
+			if (page && page->isUsed(id % ID_TABLE_PAGE_SIZE)) {
+				return iterator(this, id);
+			}
+			return end();
+		}
+
+		T & operator[](uint16_t id);
+		T & at(uint16_t id) {
+			return entry(id).second;
+		}
+		size_t erase(uint16_t id);
+		void clear();
+
+		inline size_t size() {
+			return count;
+		}
+		inline bool empty() {
+			return count == 0;
+		}
+		size_t memoryUsed();
+
+	private:
+		struct Page {
+			Page(uint16_t firstId) {
+				for (auto i = 0; i < ID_TABLE_PAGE_SIZE; i++) {
+					entries[i].first = firstId + i;
+				}
+			}
+			inline bool isUsed(uint8_t index) {
+				return used[index / 32] & (1u << (index % 32));
+			}
+
+			value_type	entries[ID_TABLE_PAGE_SIZE];
+			uint32_t	used[ID_TABLE_PAGE_SIZE / 32] = {};		// Bit per entry in use
+			uint16_t	usedCount = 0;
+		};
+
+		inline value_type & entry(uint32_t id) {
+			return pages[id / ID_TABLE_PAGE_SIZE]->entries[id % ID_TABLE_PAGE_SIZE];
+		}
+		uint32_t next(uint32_t id);
+
+		std::unique_ptr<Page>	pages[ID_TABLE_PAGES];
+		size_t					count = 0;
+};
+
+// Get the value for an ID, adding a default value if it isn't in the table
+//
+template<typename T>
+T & IdTable<T>::operator[](uint16_t id) {
+	auto & page = pages[id / ID_TABLE_PAGE_SIZE];
+	if (!page) {
+		page = make_unique_psram<Page>(id - id % ID_TABLE_PAGE_SIZE);
+	}
+	uint8_t index = id % ID_TABLE_PAGE_SIZE;
+	if (!page->isUsed(index)) {
+		page->used[index / 32] |= 1u << (index % 32);
+		page->usedCount++;
+		count++;
+	}
+	return page->entries[index].second;
+}
+
+// Remove an ID's value, returning the number of values removed
+//
+template<typename T>
+size_t IdTable<T>::erase(uint16_t id) {
+	auto & page = pages[id / ID_TABLE_PAGE_SIZE];
+	uint8_t index = id % ID_TABLE_PAGE_SIZE;
+	if (!page || !page->isUsed(index)) {
+		return 0;
+	}
+	page->entries[index].second = T();
+	page->used[index / 32] &= ~(1u << (index % 32));
+	page->usedCount--;
+	count--;
+	return 1;
+}
+
+template<typename T>
+void IdTable<T>::clear() {
+	for (auto & page : pages) {
+		page = nullptr;
+	}
+	count = 0;
+}
+
+// Memory taken by the table itself, not counting anything its values point to
+//
+template<typename T>
+size_t IdTable<T>::memoryUsed() {
+	size_t bytes = sizeof *this;
+	for (auto & page : pages) {
+		if (page) {
+			bytes += sizeof(Page);
+		}
+	}
+	return bytes;
+}
+
+// Find the first ID in use from the given one onwards, or 65536 if there isn't one
+//
+template<typename T>
+uint32_t IdTable<T>::next(uint32_t id) {
+	while (id < 65536) {
+		auto & page = pages[id / ID_TABLE_PAGE_SIZE];
+		if (!page || page->usedCount == 0) {
+			id = (id / ID_TABLE_PAGE_SIZE + 1) * ID_TABLE_PAGE_SIZE;
+			continue;
+		}
+		if (page->isUsed(id % ID_TABLE_PAGE_SIZE)) {
+			return id;
+		}
+		id++;
+	}
+	return id;
+}
+
+#endif // ID_TABLE_H
@@ -0,0 +1,99 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "buffer_stream.h"
+#include "types.h"
+
+// Decompress a raw LZ4 block (as produced by LZ4_compress_default, without a frame header)
+// Every length and offset is checked, so malformed data can't write outside the destination
+// Returns:
+// - The number of bytes written to dest, or -1 if the data is malformed or won't fit
+//
+int32_t lz4Decompress(const uint8_t * source, uint32_t sourceLength, uint8_t * dest, uint32_t destLength) {
+	auto s = source;
+	auto sEnd = source + sourceLength;
+	auto d = dest;
+	auto dEnd = dest + destLength;
+
+	while (s < sEnd) {
+		auto token = *s++;
+
+		// literals
+		uint32_t length = token >> 4;
+		if (length == 15) {
+			uint8_t b;
+			do {
+				if (s >= sEnd) return -1;
+				b = *s++;
+				length += b;
+			} while (b == 255);
+		}
+		if (length > (uint32_t)(sEnd - s) || length > (uint32_t)(dEnd - d)) {
+			return -1;
+		}
+		memcpy(d, s, length);
+		s += length;
+		d += length;
+		if (s == sEnd) {
+			// the last sequence is literals only
+			break;
+		}
+
+		// match
+		if (sEnd - s < 2) {
+			return -1;
+		}
+		uint32_t offset = s[0] | (s[1] << 8);
+		s += 2;
+		if (offset == 0 || offset > (uint32_t)(d - dest)) {
+			return -1;
+		}
+		length = (token & 0x0F) + 4;
+		if ((token & 0x0F) == 15) {
+			uint8_t b;
+			do {
+				if (s >= sEnd) return -1;
+				b = *s++;
+				length += b;
+			} while (b == 255);
+		}
+		if (length > (uint32_t)(dEnd - d)) {
+			return -1;
+		}
+		auto match = d - offset;
+		if (offset >= length) {
+			memcpy(d, match, length);
+			d += length;
+		} else {
+			// overlapping match, which repeats the last offset bytes
+			while (length--) {
+				*d++ = *match++;
+			}
+		}
+	}
+	return d - dest;
+}
+
+// Decompress a stream holding a raw LZ4 block into a new stream of the given length
+// The new stream is a staging block (see makeStagingStream) if staging is set
+// Returns nullptr if the data is malformed or doesn't decompress to exactly that length
+//
+std::shared_ptr<BufferStream> lz4DecompressStream(BufferStream & source, uint32_t length, bool staging = false) {
+	auto stream = staging ? makeStagingStream(length) : make_shared_pooled<BufferStream>(length);
+	if (!stream || (length > 0 && !stream->getBuffer())) {
+		debug_log("lz4DecompressStream: failed to allocate %d bytes\n\r", length);
+		return nullptr;
+	}
+	auto written = lz4Decompress(source.getBuffer(), source.size(), stream->getBuffer(), length);
+	if (written != (int32_t)length) {
+		debug_log("lz4DecompressStream: invalid data (%d of %d bytes decompressed)\n\r", written, length);
+		return nullptr;
+	}
+	return stream;
+}
+
+#endif // LZ4_H
@@ -5,15 +5,23 @@
 #include <vector>
 #include <Stream.h>
 
+#include "buffer_arguments.h"
 #include "buffer_stream.h"
 #include "types.h"
 
 class MultiBufferStream : public Stream {
 	public:
+		MultiBufferStream() {}
 		MultiBufferStream(std::vector<std::shared_ptr<BufferStream>> buffers);
+		void begin(const std::vector<std::shared_ptr<BufferStream>> & blocks, BufferArguments * bufferArguments = nullptr);
+		void end();
 		int available();
 		int read();
 		int peek();
+		size_t readBytes(uint8_t * data, size_t length);
+		size_t readBytes(char * data, size_t length) {
+			return readBytes((uint8_t *)data, length);
+		}
 		size_t write(uint8_t b);
 		void rewind();
 		void seekTo(uint32_t position);
@@ -21,7 +29,12 @@ class MultiBufferStream : public Stream {
 	private:
 		std::vector<std::shared_ptr<BufferStream>> buffers;
 		std::shared_ptr<BufferStream> getBuffer();
+		inline uint32_t tell(std::shared_ptr<BufferStream> & buffer) {
+			return currentBufferStart + buffer->size() - buffer->available();
+		}
 		size_t currentBufferIndex = 0;
+		uint32_t currentBufferStart = 0;			// Offset of the current block's start in the whole buffer
+		BufferArguments * arguments = nullptr;		// Arguments substituted into the blocks as they're read, if any
 };
 
 MultiBufferStream::MultiBufferStream(std::vector<std::shared_ptr<BufferStream>> buffers) : buffers(buffers) {
@@ -29,6 +42,24 @@ MultiBufferStream::MultiBufferStream(std::vector<std::shared_ptr<BufferStream>>
 	rewind();
 }
 
+// Start reading a new list of blocks from the beginning, substituting the given arguments if any
+// Our list's storage is kept from one use to the next, so this won't usually allocate
+//
+void MultiBufferStream::begin(const std::vector<std::shared_ptr<BufferStream>> & blocks, BufferArguments * bufferArguments) {
+	buffers = blocks;
+	arguments = bufferArguments;
+	rewind();
+}
+
+// Let go of the blocks, keeping the list's storage for next time
+//
+void MultiBufferStream::end() {
+	buffers.clear();
+	currentBufferIndex = 0;
+	currentBufferStart = 0;
+	arguments = nullptr;
+}
+
 int MultiBufferStream::available() {
 	auto buffer = getBuffer();
 	if (buffer) {
@@ -39,14 +70,40 @@ int MultiBufferStream::available() {
 
 int MultiBufferStream::read() {
 	auto buffer = getBuffer();
+	if (arguments && buffer) {
+		auto offset = tell(buffer);
+		return arguments->apply(offset, buffer->read());
+	}
 	return buffer->read();
 }
 
 int MultiBufferStream::peek() {
 	auto buffer = getBuffer();
+	if (arguments && buffer) {
+		return arguments->apply(tell(buffer), buffer->peek());
+	}
 	return buffer->peek();
 }
 
+// Bulk read across block boundaries, returning the number of bytes copied
+//
+size_t MultiBufferStream::readBytes(uint8_t * data, size_t length) {
+	size_t copied = 0;
+	while (copied < length) {
+		auto buffer = getBuffer();
+		if (!buffer) {
+			break;
+		}
+		auto offset = tell(buffer);
+		auto count = buffer->readBytes(data + copied, length - copied);
+		if (arguments) {
+			arguments->apply(offset, data + copied, count);
+		}
+		copied += count;
+	}
+	return copied;
+}
+
 size_t MultiBufferStream::write(uint8_t b) {
 	// write is not supported
 	return 0;
@@ -57,6 +114,7 @@ void MultiBufferStream::rewind() {
 		buffer->rewind();
 	}
 	currentBufferIndex = 0;
+	currentBufferStart = 0;
 }
 
 void MultiBufferStream::seekTo(uint32_t position) {
@@ -71,6 +129,7 @@ void MultiBufferStream::seekTo(uint32_t position) {
 		if (offset < bufferSize) {
 			// this is the buffer we want
 			currentBufferIndex = i;
+			currentBufferStart = position - offset;
 			stream->seekTo(offset);
 			return;
 		}
@@ -81,6 +140,7 @@ void MultiBufferStream::seekTo(uint32_t position) {
 	// if we get here, we've gone past the end of the buffers
 	// so just seek to the end of the last buffer
 	currentBufferIndex = buffers.size() - 1;
+	currentBufferStart = size() - buffers[currentBufferIndex]->size();
 	buffers[currentBufferIndex]->seekTo(buffers[currentBufferIndex]->size());
 }
 
@@ -94,6 +154,7 @@ uint32_t MultiBufferStream::size() {
 
 inline std::shared_ptr<BufferStream> MultiBufferStream::getBuffer() {
 	while (currentBufferIndex < buffers.size() && !buffers[currentBufferIndex]->available()) {
+		currentBufferStart += buffers[currentBufferIndex]->size();
 		currentBufferIndex++;
 	}
 	if (currentBufferIndex >= buffers.size()) {
@@ -0,0 +1,103 @@
+//
+// Title:			Native build stand-in for the Arduino core
+// Created:			17/10/2026
+//
+// Provides just enough of the Arduino and ESP-IDF runtime for the VDP's
+// protocol, buffer, audio and teletext code to build and run on a Linux host
+//
+
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <algorithm>
+
+#include "freertos/FreeRTOS.h"
+#include "Stream.h"
+#include "HardwareSerial.h"
+
+#define PROGMEM
+#define IRAM_ATTR
+
+// Timing
+// All times are relative to the first call, as on the ESP32 they are relative to boot
+//
+inline std::chrono::steady_clock::time_point nativeBootTime() {
+	static auto bootTime = std::chrono::steady_clock::now();
+	return bootTime;
+}
+
+inline unsigned long millis() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - nativeBootTime()).count();
+}
+
+inline unsigned long micros() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - nativeBootTime()).count();
+}
+
+inline void delay(uint32_t ms) {
+	vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+inline long map(long x, long in_min, long in_max, long out_min, long out_max) {
+	return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+inline void disableCore0WDT() {}
+inline void disableCore1WDT() {}
+
+// Memory
+// The host has no PSRAM, so PSRAM allocations come from the regular heap
+//
+#define MALLOC_CAP_8BIT			(1 << 2)
+#define MALLOC_CAP_32BIT		(1 << 1)
+#define MALLOC_CAP_SPIRAM		(1 << 10)
+#define MALLOC_CAP_INTERNAL		(1 << 11)
+
+inline bool psramInit() {
+	return true;
+}
+
+inline void * ps_malloc(size_t size) {
+	return malloc(size);
+}
+
+inline size_t heap_caps_get_free_size(uint32_t caps) {
+	return 4 * 1024 * 1024;
+}
+
+inline size_t heap_caps_get_largest_free_block(uint32_t caps) {
+	return 4 * 1024 * 1024;
+}
+
+// System
+//
+typedef int esp_err_t;
+
+#define ESP_OK					0
+#define ESP_FAIL				-1
+
+typedef enum {
+	ESP_RST_UNKNOWN,
+	ESP_RST_POWERON,
+	ESP_RST_EXT,
+	ESP_RST_SW,
+	ESP_RST_PANIC,
+} esp_reset_reason_t;
+
+inline esp_reset_reason_t esp_reset_reason() {
+	return ESP_RST_POWERON;
+}
+
+inline void esp_restart() {
+	exit(0);
+}
+
+#endif // NATIVE_ARDUINO_H
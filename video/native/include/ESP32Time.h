@@ -0,0 +1,49 @@
+//
+// Title:			Native build stand-in for the ESP32Time library
+// Created:			17/10/2026
+//
+// Keeps time as an offset from the host clock
+//
+
+#ifndef NATIVE_ESP32TIME_H
+#define NATIVE_ESP32TIME_H
+
+#include <ctime>
+
+class ESP32Time {
+	public:
+		ESP32Time(unsigned long offset = 0) : offset(offset) {}
+
+		void setTime(int sc, int mn, int hr, int dy, int mt, int yr) {
+			struct tm t = {};
+			t.tm_year = yr - 1900;
+			t.tm_mon = mt - 1;
+			t.tm_mday = dy;
+			t.tm_hour = hr;
+			t.tm_min = mn;
+			t.tm_sec = sc;
+			adjust = mktime(&t) - ::time(nullptr);
+		}
+
+		int getSecond()			{ return getTimeStruct().tm_sec; }
+		int getMinute()			{ return getTimeStruct().tm_min; }
+		int getHour(bool mode)	{ auto hour = getTimeStruct().tm_hour; return mode ? hour : (hour % 12 == 0 ? 12 : hour % 12); }
+		int getDay()			{ return getTimeStruct().tm_mday; }
+		int getDayofWeek()		{ return getTimeStruct().tm_wday; }
+		int getDayofYear()		{ return getTimeStruct().tm_yday; }
+		int getMonth()			{ return getTimeStruct().tm_mon; }
+		int getYear()			{ return getTimeStruct().tm_year + 1900; }
+
+	private:
+		struct tm getTimeStruct() {
+			time_t now = ::time(nullptr) + adjust + offset;
+			struct tm t;
+			localtime_r(&now, &t);
+			return t;
+		}
+
+		unsigned long offset;
+		time_t adjust = 0;
+};
+
+#endif // NATIVE_ESP32TIME_H
@@ -0,0 +1,114 @@
+//
+// Title:			Native build stand-in for the ESP32 HardwareSerial class
+// Created:			17/10/2026
+//
+// UART 0 (the debug port) writes to stdout
+// Any other UART is a pair of memory queues: the host program pushes bytes in with
+// inject() as if the eZ80 had sent them, and takes anything the VDP sent with drain()
+//
+
+#ifndef NATIVE_HARDWARESERIAL_H
+#define NATIVE_HARDWARESERIAL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "Stream.h"
+
+#define SERIAL_8N1				0x800001c
+#define HW_FLOWCTRL_RTS			1
+
+class HardwareSerial : public Stream {
+	public:
+		HardwareSerial(int uart_nr) : uart_nr(uart_nr) {}
+
+		void begin(unsigned long newBaud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1) {
+			baud = newBaud;
+		}
+		void end() {}
+		size_t setRxBufferSize(size_t size) {
+			return size;
+		}
+		bool setHwFlowCtrlMode(uint8_t mode, uint8_t threshold) {
+			return true;
+		}
+		bool setPins(int8_t rxPin, int8_t txPin, int8_t ctsPin = -1, int8_t rtsPin = -1) {
+			return true;
+		}
+		void updateBaudRate(unsigned long newBaud) {
+			baud = newBaud;
+		}
+		uint32_t baudRate() {
+			return baud;
+		}
+
+		int available() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return rx.size();
+		}
+		int read() {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (rx.empty()) {
+				return -1;
+			}
+			uint8_t b = rx.front();
+			rx.pop_front();
+			return b;
+		}
+		size_t read(uint8_t * buffer, size_t size) {
+			std::lock_guard<std::mutex> lock(mutex);
+			size_t count = std::min(size, rx.size());
+			std::copy(rx.begin(), rx.begin() + count, buffer);
+			rx.erase(rx.begin(), rx.begin() + count);
+			return count;
+		}
+		int peek() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return rx.empty() ? -1 : rx.front();
+		}
+		size_t write(uint8_t b) {
+			return write(&b, 1);
+		}
+		size_t write(const uint8_t * buffer, size_t size) {
+			if (uart_nr == 0) {
+				return fwrite(buffer, 1, size, stdout);
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			tx.insert(tx.end(), buffer, buffer + size);
+			return size;
+		}
+		using Print::write;
+		void flush() {
+			if (uart_nr == 0) {
+				fflush(stdout);
+			}
+		}
+
+		// Host side of the port
+		//
+		void inject(const uint8_t * buffer, size_t size) {
+			std::lock_guard<std::mutex> lock(mutex);
+			rx.insert(rx.end(), buffer, buffer + size);
+		}
+		std::vector<uint8_t> drain() {
+			std::lock_guard<std::mutex> lock(mutex);
+			std::vector<uint8_t> sent;
+			sent.swap(tx);
+			return sent;
+		}
+
+	private:
+		int uart_nr;
+		unsigned long baud = 0;
+		std::mutex mutex;
+		std::deque<uint8_t> rx;
+		std::vector<uint8_t> tx;
+};
+
+extern HardwareSerial Serial2;
+
+#endif // NATIVE_HARDWARESERIAL_H
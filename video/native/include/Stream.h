@@ -0,0 +1,68 @@
+//
+// Title:			Native build stand-in for the Arduino Print and Stream classes
+// Created:			17/10/2026
+//
+
+#ifndef NATIVE_STREAM_H
+#define NATIVE_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+class Print {
+	public:
+		virtual ~Print() {}
+		virtual size_t write(uint8_t b) = 0;
+		virtual size_t write(const uint8_t * buffer, size_t size) {
+			size_t n = 0;
+			while (size--) {
+				if (!write(*buffer++)) {
+					break;
+				}
+				n++;
+			}
+			return n;
+		}
+		size_t write(const char * str) {
+			return str ? write((const uint8_t *)str, strlen(str)) : 0;
+		}
+		size_t write(const char * buffer, size_t size) {
+			return write((const uint8_t *)buffer, size);
+		}
+		size_t print(const char * str) {
+			return write(str);
+		}
+		virtual void flush() {}
+};
+
+class Stream : public Print {
+	public:
+		virtual int available() = 0;
+		virtual int read() = 0;
+		virtual int peek() = 0;
+
+		void setTimeout(unsigned long timeout) {
+			_timeout = timeout;
+		}
+		virtual size_t readBytes(char * buffer, size_t length) {
+			size_t count = 0;
+			while (count < length) {
+				int c = read();
+				if (c < 0) {
+					break;
+				}
+				*buffer++ = (char)c;
+				count++;
+			}
+			return count;
+		}
+		virtual size_t readBytes(uint8_t * buffer, size_t length) {
+			return readBytes((char *)buffer, length);
+		}
+
+	protected:
+		unsigned long _timeout = 1000;
+};
+
+#endif // NATIVE_STREAM_H
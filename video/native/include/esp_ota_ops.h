@@ -0,0 +1,33 @@
+//
+// Title:			Native build stand-in for the ESP-IDF OTA API
+// Created:			17/10/2026
+//
+// There is nowhere to flash firmware on the host, so updates always fail to start
+//
+
+#ifndef NATIVE_ESP_OTA_OPS_H
+#define NATIVE_ESP_OTA_OPS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Arduino.h"
+
+#define OTA_SIZE_UNKNOWN		0xffffffff
+
+typedef uint32_t esp_ota_handle_t;
+
+typedef struct {
+	uint32_t	address;
+	uint32_t	size;
+	char		label[17];
+} esp_partition_t;
+
+inline const esp_partition_t * esp_ota_get_boot_partition() { return nullptr; }
+inline const esp_partition_t * esp_ota_get_running_partition() { return nullptr; }
+inline const esp_partition_t * esp_ota_get_next_update_partition(const esp_partition_t * start) { return nullptr; }
+inline esp_err_t esp_ota_begin(const esp_partition_t * partition, size_t size, esp_ota_handle_t * handle) { return ESP_FAIL; }
+inline esp_err_t esp_ota_write(esp_ota_handle_t handle, const void * data, size_t size) { return ESP_FAIL; }
+inline esp_err_t esp_ota_set_boot_partition(const esp_partition_t * partition) { return ESP_FAIL; }
+
+#endif // NATIVE_ESP_OTA_OPS_H
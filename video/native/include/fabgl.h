@@ -0,0 +1,681 @@
+//
+// Title:			Native build stand-in for vdp-gl (fabgl)
+// Created:			17/10/2026
+//
+// Only the parts of the library the VDP uses are provided
+// The canvas keeps a real RGB888 frame buffer so that pixel reads, fills and scrolls
+// behave sensibly, but lines, paths, ellipses and glyphs just move the pen
+// Keyboard and mouse never report any input, and sound generators produce silence
+//
+
+#ifndef NATIVE_FABGL_H
+#define NATIVE_FABGL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "Arduino.h"
+
+#define VGA_320x200_70Hz		"\"320x200@70Hz\" 12.5875 320 328 376 400 200 206 207 224 -HSync -VSync DoubleScan"
+#define VGA_320x200_75Hz		"\"320x200@75Hz\" 12.93 320 352 376 408 200 208 211 229 -HSync -VSync DoubleScan"
+#define QVGA_320x240_60Hz		"\"320x240@60Hz\" 12.6 320 328 376 400 240 245 246 262 -HSync -VSync DoubleScan"
+#define VGA_512x384_60Hz		"\"512x384@60Hz\" 32.5 512 524 592 672 384 385 388 403 -HSync -VSync DoubleScan"
+#define VGA_640x240_60Hz		"\"640x240@60Hz\" 25.175 640 656 752 800 240 245 247 262 -HSync -VSync DoubleScan"
+#define VGA_640x480_60Hz		"\"640x480@60Hz\" 25.175 640 656 752 800 480 490 492 525 -HSync -VSync"
+#define SVGA_800x600_60Hz		"\"800x600@60Hz\" 40 800 840 968 1056 600 601 605 628 -HSync -VSync"
+#define SVGA_1024x768_60Hz		"\"1024x768@60Hz\" 65 1024 1048 1184 1344 768 771 777 806 -HSync -VSync"
+
+namespace fabgl {
+
+// Geometry and colour
+//
+struct Point {
+	int16_t X;
+	int16_t Y;
+
+	Point() : X(0), Y(0) {}
+	Point(int X, int Y) : X(X), Y(Y) {}
+
+	Point add(Point const & p) const { return Point(X + p.X, Y + p.Y); }
+	Point sub(Point const & p) const { return Point(X - p.X, Y - p.Y); }
+	bool operator==(Point const & r) { return X == r.X && Y == r.Y; }
+	bool operator!=(Point const & r) { return X != r.X || Y != r.Y; }
+};
+
+struct Size {
+	int16_t width;
+	int16_t height;
+
+	Size() : width(0), height(0) {}
+	Size(int width, int height) : width(width), height(height) {}
+};
+
+struct Rect {
+	int16_t X1;
+	int16_t Y1;
+	int16_t X2;
+	int16_t Y2;
+
+	Rect() : X1(0), Y1(0), X2(0), Y2(0) {}
+	Rect(int X1, int Y1, int X2, int Y2) : X1(X1), Y1(Y1), X2(X2), Y2(Y2) {}
+
+	bool operator==(Rect const & r) { return X1 == r.X1 && Y1 == r.Y1 && X2 == r.X2 && Y2 == r.Y2; }
+	bool operator!=(Rect const & r) { return !(*this == r); }
+	int width() const { return X2 - X1 + 1; }
+	int height() const { return Y2 - Y1 + 1; }
+	bool contains(int x, int y) const { return x >= X1 && y >= Y1 && x <= X2 && y <= Y2; }
+	bool intersects(Rect const & rect) const {
+		return X1 <= rect.X2 && X2 >= rect.X1 && Y1 <= rect.Y2 && Y2 >= rect.Y1;
+	}
+	Rect intersection(Rect const & rect) const {
+		return Rect(std::max(X1, rect.X1), std::max(Y1, rect.Y1), std::min(X2, rect.X2), std::min(Y2, rect.Y2));
+	}
+};
+
+struct RGB888 {
+	uint8_t R;
+	uint8_t G;
+	uint8_t B;
+
+	constexpr RGB888() : R(0), G(0), B(0) {}
+	constexpr RGB888(uint8_t R, uint8_t G, uint8_t B) : R(R), G(G), B(B) {}
+};
+
+inline bool operator==(RGB888 const & lhs, RGB888 const & rhs) {
+	return lhs.R == rhs.R && lhs.G == rhs.G && lhs.B == rhs.B;
+}
+
+inline bool operator!=(RGB888 const & lhs, RGB888 const & rhs) {
+	return !(lhs == rhs);
+}
+
+struct RGBA8888 {
+	uint8_t R;
+	uint8_t G;
+	uint8_t B;
+	uint8_t A;
+};
+
+struct PaintOptions {
+	uint8_t swapFGBG : 1;
+	uint8_t NOT : 1;
+	uint8_t AND : 1;
+	uint8_t OR : 1;
+	uint8_t XOR : 1;
+
+	PaintOptions() : swapFGBG(false), NOT(false), AND(false), OR(false), XOR(false) {}
+};
+
+struct GlyphOptions {
+	uint8_t fillBackground : 1;
+	uint8_t invert : 1;
+
+	GlyphOptions() : fillBackground(0), invert(0) {}
+	GlyphOptions & FillBackground(bool value) { fillBackground = value; return *this; }
+	GlyphOptions & Invert(uint8_t value) { invert = value; return *this; }
+};
+
+struct FontInfo {
+	uint8_t			pointSize;
+	uint8_t			width;
+	uint8_t			height;
+	uint8_t			ascent;
+	uint8_t			inleading;
+	uint8_t			exleading;
+	uint8_t			flags;
+	uint16_t		weight;
+	uint16_t		charset;
+	uint8_t const *	data;
+	uint32_t const *chptr;
+	uint16_t		codepage;
+};
+
+// Bitmaps, sprites and mouse cursors
+//
+enum class PixelFormat : uint8_t {
+	Undefined,
+	Native,
+	Mask,
+	RGBA2222,
+	RGBA8888,
+};
+
+struct Bitmap {
+	int16_t			width = 0;
+	int16_t			height = 0;
+	PixelFormat		format = PixelFormat::Undefined;
+	RGB888			foregroundColor;
+	uint8_t *		data = nullptr;
+	bool			dataAllocated = false;
+
+	Bitmap() {}
+	Bitmap(int width, int height, void const * data, PixelFormat format, bool copy = false)
+		: Bitmap(width, height, data, format, RGB888(255, 255, 255), copy) {}
+	Bitmap(int width, int height, void const * data, PixelFormat format, RGB888 foregroundColor, bool copy = false)
+		: width(width), height(height), format(format), foregroundColor(foregroundColor), data((uint8_t *)data)
+	{
+		if (copy) {
+			auto size = dataSize();
+			this->data = (uint8_t *)malloc(size);
+			memcpy(this->data, data, size);
+			dataAllocated = true;
+		}
+	}
+	~Bitmap() {
+		if (dataAllocated) {
+			free(data);
+		}
+	}
+
+	int dataSize() const {
+		switch (format) {
+			case PixelFormat::Mask:		return (width + 7) / 8 * height;
+			case PixelFormat::RGBA2222:	return width * height;
+			case PixelFormat::RGBA8888:	return width * height * 4;
+			default:					return 0;
+		}
+	}
+};
+
+struct Sprite {
+	int16_t			x = 0;
+	int16_t			y = 0;
+	Bitmap * *		frames = nullptr;
+	int16_t			framesCount = 0;
+	int16_t			currentFrame = 0;
+	uint8_t			visible = 1;
+	uint8_t			isStatic = 0;
+	uint8_t			allowDraw = 1;
+
+	~Sprite() {
+		free(frames);
+	}
+
+	Bitmap * getFrame() { return frames ? frames[currentFrame] : nullptr; }
+	int getFrameIndex() { return currentFrame; }
+	void nextFrame() { ++currentFrame; if (currentFrame >= framesCount) currentFrame = 0; }
+	Sprite * setFrame(int frame) { currentFrame = frame; return this; }
+	Sprite * addBitmap(Bitmap * bitmap) {
+		++framesCount;
+		frames = (Bitmap **)realloc(frames, sizeof(Bitmap *) * framesCount);
+		frames[framesCount - 1] = bitmap;
+		return this;
+	}
+	Sprite * addBitmap(Bitmap * bitmap[], int count) {
+		for (int i = 0; i < count; i++) {
+			addBitmap(bitmap[i]);
+		}
+		return this;
+	}
+	void clearBitmaps() {
+		free(frames);
+		frames = nullptr;
+		framesCount = 0;
+		currentFrame = 0;
+	}
+	Sprite * moveBy(int offsetX, int offsetY) { x += offsetX; y += offsetY; return this; }
+	Sprite * moveTo(int x, int y) { this->x = x; this->y = y; return this; }
+};
+
+struct Cursor {
+	int16_t			hotspotX;
+	int16_t			hotspotY;
+	Bitmap			bitmap;
+};
+
+enum CursorName : uint8_t {
+	CursorPointerAmigaLike,
+	CursorPointerSimpleReduced,
+	CursorPointerSimple,
+	CursorPointerShadowed,
+	CursorPointer,
+	CursorPen,
+	CursorCross1,
+	CursorCross2,
+	CursorPoint,
+	CursorLeftArrow,
+	CursorRightArrow,
+	CursorDownArrow,
+	CursorUpArrow,
+	CursorMove,
+	CursorResize1,
+	CursorResize2,
+	CursorResize3,
+	CursorResize4,
+	CursorTextInput,
+};
+
+// Display controllers
+// All of them share a single implementation, as nothing is ever displayed
+//
+class VGABaseController {
+	public:
+		virtual ~VGABaseController() {}
+
+		void begin() {}
+		void end() {}
+		void enableBackgroundPrimitiveExecution(bool value) {}
+		void enableBackgroundPrimitiveTimeout(bool value) {}
+		void setResolution(char const * modeline, int viewPortWidth = -1, int viewPortHeight = -1, bool doubleBuffered = false) {
+			// the modeline's first two numbers after the clock are the visible width and height
+			auto p = strchr(modeline + 1, '"');
+			float clock;
+			int hVisible, hSyncStart, hSyncEnd, hTotal, vVisible;
+			if (p && sscanf(p + 1, "%f %d %d %d %d %d", &clock, &hVisible, &hSyncStart, &hSyncEnd, &hTotal, &vVisible) == 6) {
+				width = hVisible;
+				height = vVisible;
+			}
+			this->doubleBuffered = doubleBuffered;
+		}
+		int getScreenWidth() { return width; }
+		int getScreenHeight() { return height; }
+		int getViewPortWidth() { return width; }
+		int getViewPortHeight() { return height; }
+		bool isDoubleBuffered() { return doubleBuffered; }
+
+		void setPaletteItem(int index, RGB888 const & color) {}
+		void updateRGB2PaletteLUT() {}
+
+		void setMouseCursor(Cursor * cursor) {}
+		void setMouseCursor(CursorName cursorName) {}
+		void setMouseCursorPos(int X, int Y) {}
+
+		template <typename T>
+		void setSprites(T * sprites, int count) {}
+		void removeSprites() {}
+		void refreshSprites() {}
+
+	private:
+		int width = 640;
+		int height = 480;
+		bool doubleBuffered = false;
+};
+
+template <typename Derived>
+class NativeVGAController : public VGABaseController {
+	public:
+		NativeVGAController() { s_instance = static_cast<Derived *>(this); }
+		~NativeVGAController() { if (s_instance == this) s_instance = nullptr; }
+		static Derived * instance() { return s_instance; }
+
+	private:
+		static Derived * s_instance;
+};
+
+template <typename Derived>
+Derived * NativeVGAController<Derived>::s_instance = nullptr;
+
+class VGA2Controller : public NativeVGAController<VGA2Controller> {};
+class VGA4Controller : public NativeVGAController<VGA4Controller> {};
+class VGA8Controller : public NativeVGAController<VGA8Controller> {};
+class VGA16Controller : public NativeVGAController<VGA16Controller> {};
+class VGAController : public NativeVGAController<VGAController> {};
+
+// Drawing canvas
+//
+class Canvas {
+	public:
+		Canvas(VGABaseController * displayController)
+			: width(displayController->getViewPortWidth()), height(displayController->getViewPortHeight()),
+			  pixels(width * height), clippingRect(0, 0, width - 1, height - 1), scrollingRegion(clippingRect) {}
+
+		int getWidth() { return width; }
+		int getHeight() { return height; }
+
+		void reset() {
+			penColor = RGB888(255, 255, 255);
+			brushColor = RGB888(0, 0, 0);
+			paintOptions = PaintOptions();
+			clippingRect = Rect(0, 0, width - 1, height - 1);
+			scrollingRegion = clippingRect;
+		}
+		void waitCompletion(bool waitVSync = true) {}
+		void swapBuffers() {}
+
+		void setPenColor(RGB888 const & color) { penColor = color; }
+		void setBrushColor(RGB888 const & color) { brushColor = color; }
+		void setPenWidth(int value) {}
+		void setPaintOptions(PaintOptions options) { paintOptions = options; }
+		void setGlyphOptions(GlyphOptions options) { glyphOptions = options; }
+		void setClippingRect(Rect const & rect) { clippingRect = rect; }
+		void setScrollingRegion(int X1, int Y1, int X2, int Y2) { scrollingRegion = Rect(X1, Y1, X2, Y2); }
+		void selectFont(FontInfo const * fontInfo) { font = fontInfo; }
+		FontInfo const * getFontInfo() { return font; }
+
+		RGB888 getPixel(int X, int Y) {
+			if (X < 0 || Y < 0 || X >= width || Y >= height) {
+				return RGB888();
+			}
+			return pixels[Y * width + X];
+		}
+		void setPixel(int X, int Y) { setPixel(X, Y, penColor); }
+		void setPixel(int X, int Y, RGB888 const & color) {
+			if (clippingRect.contains(X, Y) && X >= 0 && Y >= 0 && X < width && Y < height) {
+				pixels[Y * width + X] = paintOptions.NOT ? RGB888(~color.R, ~color.G, ~color.B) : color;
+			}
+		}
+		void setPixel(Point const & pos) { setPixel(pos.X, pos.Y); }
+		void setPixel(Point const & pos, RGB888 const & color) { setPixel(pos.X, pos.Y, color); }
+
+		void moveTo(int X, int Y) { penPos = Point(X, Y); }
+		void lineTo(int X, int Y) { penPos = Point(X, Y); }
+		void drawLine(int X1, int Y1, int X2, int Y2) { penPos = Point(X2, Y2); }
+		void drawPath(Point const * points, int pointsCount) {}
+		void fillPath(Point const * points, int pointsCount) {}
+		void drawEllipse(int X, int Y, int width, int height) {}
+		void fillEllipse(int X, int Y, int width, int height) {}
+		void drawChar(int X, int Y, uint8_t c) {}
+		void drawBitmap(int X, int Y, Bitmap const * bitmap) {}
+
+		void fillRectangle(int X1, int Y1, int X2, int Y2) {
+			fill(Rect(std::min(X1, X2), std::min(Y1, Y2), std::max(X1, X2), std::max(Y1, Y2)).intersection(clippingRect), brushColor);
+		}
+		void fillRectangle(Rect const & rect) { fillRectangle(rect.X1, rect.Y1, rect.X2, rect.Y2); }
+		void clear() { fill(clippingRect, brushColor); }
+		void swapRectangle(int X1, int Y1, int X2, int Y2) {}
+
+		void copyRect(int sourceX, int sourceY, int destX, int destY, int width, int height) {
+			std::vector<RGB888> copy;
+			copy.reserve(width * height);
+			for (int y = 0; y < height; y++) {
+				for (int x = 0; x < width; x++) {
+					copy.push_back(getPixel(sourceX + x, sourceY + y));
+				}
+			}
+			for (int y = 0; y < height; y++) {
+				for (int x = 0; x < width; x++) {
+					setPixel(destX + x, destY + y, copy[y * width + x]);
+				}
+			}
+		}
+
+		void scroll(int offsetX, int offsetY) {
+			auto r = scrollingRegion.intersection(Rect(0, 0, width - 1, height - 1));
+			if (r.X2 < r.X1 || r.Y2 < r.Y1) {
+				return;
+			}
+			if (abs(offsetX) >= r.width() || abs(offsetY) >= r.height()) {
+				fill(r, brushColor);
+				return;
+			}
+			// move rows in an order that never overwrites a row that has still to be read
+			if (offsetY <= 0) {
+				for (int y = r.Y1; y <= r.Y2; y++) {
+					scrollRow(r, y, y - offsetY, offsetX);
+				}
+			} else {
+				for (int y = r.Y2; y >= r.Y1; y--) {
+					scrollRow(r, y, y - offsetY, offsetX);
+				}
+			}
+		}
+
+	private:
+		void scrollRow(Rect const & r, int y, int sourceY, int offsetX) {
+			auto row = &pixels[y * width];
+			if (sourceY < r.Y1 || sourceY > r.Y2) {
+				std::fill(row + r.X1, row + r.X2 + 1, brushColor);
+				return;
+			}
+			auto source = &pixels[sourceY * width];
+			int length = r.width() - abs(offsetX);
+			if (offsetX >= 0) {
+				memmove(row + r.X1 + offsetX, source + r.X1, length * sizeof(RGB888));
+				std::fill(row + r.X1, row + r.X1 + offsetX, brushColor);
+			} else {
+				memmove(row + r.X1, source + r.X1 - offsetX, length * sizeof(RGB888));
+				std::fill(row + r.X1 + length, row + r.X2 + 1, brushColor);
+			}
+		}
+
+		void fill(Rect const & rect, RGB888 const & color) {
+			for (int y = std::max<int>(rect.Y1, 0); y <= std::min<int>(rect.Y2, height - 1); y++) {
+				for (int x = std::max<int>(rect.X1, 0); x <= std::min<int>(rect.X2, width - 1); x++) {
+					pixels[y * width + x] = color;
+				}
+			}
+		}
+
+		int width;
+		int height;
+		std::vector<RGB888> pixels;
+		Rect clippingRect;
+		Rect scrollingRegion;
+		RGB888 penColor = RGB888(255, 255, 255);
+		RGB888 brushColor;
+		Point penPos;
+		PaintOptions paintOptions;
+		GlyphOptions glyphOptions;
+		FontInfo const * font = nullptr;
+};
+
+// Keyboard
+//
+enum VirtualKey {
+	VK_NONE,
+	VK_SPACE,
+	VK_BACKSPACE,
+	VK_TAB,
+	VK_RETURN,
+	VK_ESCAPE,
+	VK_UP,
+	VK_DOWN,
+	VK_LEFT,
+	VK_RIGHT,
+};
+
+struct VirtualKeyItem {
+	VirtualKey	vk;
+	uint8_t		down;
+	uint8_t		scancode[8];
+	uint8_t		ASCII;
+	uint8_t		CTRL : 1;
+	uint8_t		LALT : 1;
+	uint8_t		RALT : 1;
+	uint8_t		SHIFT : 1;
+	uint8_t		GUI : 1;
+	uint8_t		CAPSLOCK : 1;
+	uint8_t		NUMLOCK : 1;
+	uint8_t		SCROLLLOCK : 1;
+};
+
+struct KeyboardLayout {
+	const char *	name;
+	const char *	desc;
+};
+
+static const KeyboardLayout USLayout = { "US", "US English" };
+static const KeyboardLayout UKLayout = { "UK", "UK English" };
+static const KeyboardLayout GermanLayout = { "German", "German" };
+static const KeyboardLayout ItalianLayout = { "Italian", "Italian" };
+static const KeyboardLayout SpanishLayout = { "Spanish", "Spanish" };
+static const KeyboardLayout FrenchLayout = { "French", "French" };
+static const KeyboardLayout BelgianLayout = { "Belgian", "Belgian" };
+static const KeyboardLayout NorwegianLayout = { "Norwegian", "Norwegian" };
+static const KeyboardLayout JapaneseLayout = { "Japanese", "Japanese" };
+static const KeyboardLayout USInternationalLayout = { "USInternational", "US International" };
+static const KeyboardLayout USInternationalAltLayout = { "USInternationalAlt", "US International Alt" };
+static const KeyboardLayout SwissGLayout = { "SwissG", "Swiss German" };
+static const KeyboardLayout SwissFLayout = { "SwissF", "Swiss French" };
+static const KeyboardLayout DanishLayout = { "Danish", "Danish" };
+static const KeyboardLayout SwedishLayout = { "Swedish", "Swedish" };
+static const KeyboardLayout PortugueseLayout = { "Portuguese", "Portuguese" };
+
+struct CodePage {
+	uint16_t codepage;
+};
+
+struct CodePages {
+	static CodePage const * get(uint16_t codepage) {
+		static const CodePage cp { 1252 };
+		return &cp;
+	}
+};
+
+class Keyboard {
+	public:
+		void setLayout(KeyboardLayout const * layout) { this->layout = layout; }
+		void setCodePage(CodePage const * codepage) {}
+		bool setTypematicRateAndDelay(int repeatRateMS, int repeatDelayMS) { return true; }
+		bool getNextVirtualKey(VirtualKeyItem * item, int timeOutMS = -1) { return false; }
+		bool getLEDs(bool * numLock, bool * capsLock, bool * scrollLock) {
+			*numLock = this->numLock;
+			*capsLock = this->capsLock;
+			*scrollLock = this->scrollLock;
+			return true;
+		}
+		bool setLEDs(bool numLock, bool capsLock, bool scrollLock) {
+			this->numLock = numLock;
+			this->capsLock = capsLock;
+			this->scrollLock = scrollLock;
+			return true;
+		}
+
+	private:
+		KeyboardLayout const * layout = nullptr;
+		bool numLock = false;
+		bool capsLock = false;
+		bool scrollLock = false;
+};
+
+// Mouse
+//
+struct MouseButtons {
+	uint8_t left : 1;
+	uint8_t middle : 1;
+	uint8_t right : 1;
+};
+
+struct MouseDelta {
+	int16_t			deltaX;
+	int16_t			deltaY;
+	int8_t			deltaZ;
+	MouseButtons	buttons;
+	uint8_t			overflowX;
+	uint8_t			overflowY;
+};
+
+struct MouseStatus {
+	int16_t			X;
+	int16_t			Y;
+	int8_t			wheelDelta;
+	MouseButtons	buttons;
+};
+
+class Mouse {
+	public:
+		bool isMouseAvailable() { return false; }
+		bool reset() { return true; }
+		void resumePort() {}
+		void suspendPort() {}
+		bool setSampleRate(int value) { return true; }
+		bool setResolution(int value) { return true; }
+		bool setScaling(int value) { return true; }
+		int & movementAcceleration() { return m_movementAcceleration; }
+		int & wheelAcceleration() { return m_wheelAcceleration; }
+		void setupAbsolutePositioner(int width, int height, bool createAbsolutePositionsQueue = false, VGABaseController * updateDisplayController = nullptr) {
+			area = Size(width, height);
+		}
+		void terminateAbsolutePositioner() {}
+		bool deltaAvailable() { return false; }
+		bool getNextDelta(MouseDelta * delta, int timeOutMS = -1, bool requestResendOnTimeOut = false) { return false; }
+		void updateAbsolutePosition(MouseDelta * delta) {
+			m_status.X = std::max(0, std::min(area.width - 1, m_status.X + delta->deltaX));
+			m_status.Y = std::max(0, std::min(area.height - 1, m_status.Y - delta->deltaY));
+			m_status.wheelDelta = delta->deltaZ;
+			m_status.buttons = delta->buttons;
+		}
+		MouseStatus & status() { return m_status; }
+
+	private:
+		int m_movementAcceleration = 180;
+		int m_wheelAcceleration = 60000;
+		Size area;
+		MouseStatus m_status = {};
+};
+
+class PS2Controller {
+	public:
+		void begin() {}
+		Keyboard * keyboard() { return &m_keyboard; }
+		Mouse * mouse() { return &m_mouse; }
+
+	private:
+		Keyboard m_keyboard;
+		Mouse m_mouse;
+};
+
+// Sound
+//
+class WaveformGenerator {
+	public:
+		virtual ~WaveformGenerator() {}
+
+		virtual void setFrequency(int value) = 0;
+		virtual int getSample() = 0;
+
+		void setSampleRate(int value) { m_sampleRate = value; }
+		uint16_t sampleRate() { return m_sampleRate; }
+		void enable(bool value) { m_enabled = value; }
+		bool enabled() { return m_enabled; }
+		void setVolume(int value) { m_volume = value; }
+		int volume() { return m_volume; }
+		void setDuration(uint32_t value) { m_duration = value; }
+		uint32_t duration() { return m_duration; }
+		void decDuration() { --m_duration; if (m_duration == 0) m_enabled = false; }
+
+	private:
+		uint16_t m_sampleRate = 16000;
+		int8_t m_volume = 100;
+		bool m_enabled = false;
+		uint32_t m_duration = -1;
+};
+
+class NativeSilentGenerator : public WaveformGenerator {
+	public:
+		void setFrequency(int value) { frequency = value; }
+		int getSample() { return 0; }
+
+	private:
+		int frequency = 0;
+};
+
+class SineWaveformGenerator : public NativeSilentGenerator {};
+class SquareWaveformGenerator : public NativeSilentGenerator {};
+class TriangleWaveformGenerator : public NativeSilentGenerator {};
+class SawtoothWaveformGenerator : public NativeSilentGenerator {};
+class NoiseWaveformGenerator : public NativeSilentGenerator {};
+class VICNoiseGenerator : public NativeSilentGenerator {};
+
+class SoundGenerator {
+	public:
+		bool play(bool value) { playing = value; return true; }
+		void attach(WaveformGenerator * value) {}
+		void detach(WaveformGenerator * value) {}
+
+	private:
+		bool playing = false;
+};
+
+} // namespace fabgl
+
+using fabgl::Point;
+using fabgl::Rect;
+using fabgl::RGB888;
+using fabgl::GlyphOptions;
+using fabgl::PixelFormat;
+using fabgl::Bitmap;
+using fabgl::Sprite;
+using fabgl::CursorName;
+using fabgl::MouseDelta;
+using fabgl::WaveformGenerator;
+using fabgl::SineWaveformGenerator;
+using fabgl::SquareWaveformGenerator;
+using fabgl::TriangleWaveformGenerator;
+using fabgl::SawtoothWaveformGenerator;
+using fabgl::NoiseWaveformGenerator;
+using fabgl::VICNoiseGenerator;
+
+#endif // NATIVE_FABGL_H
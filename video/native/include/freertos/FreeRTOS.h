@@ -0,0 +1,119 @@
+//
+// Title:			Native build stand-in for the FreeRTOS task API
+// Created:			17/10/2026
+//
+// Tasks run as host threads. As on the ESP32, creating a task lets it run until it
+// first blocks, vTaskDelay can be cut short by xTaskAbortDelay, and a deleted task
+// never runs again (it is stopped at its next delay)
+//
+
+#ifndef NATIVE_FREERTOS_H
+#define NATIVE_FREERTOS_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define configTICK_RATE_HZ		1000
+#define portTICK_PERIOD_MS		(1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY			(TickType_t)0xffffffffUL
+#define pdMS_TO_TICKS(ms)		((TickType_t)(((TickType_t)(ms) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000U))
+#define pdPASS					1
+#define pdFAIL					0
+#define pdTRUE					1
+#define pdFALSE					0
+
+struct NativeTask {
+	std::mutex				mutex;
+	std::condition_variable	signal;
+	bool					blocked = false;	// Has reached its first delay
+	bool					aborted = false;	// Current delay was cut short
+	bool					deleted = false;	// vTaskDelete has been called
+	bool					stopped = false;	// Thread has finished
+};
+
+typedef NativeTask * TaskHandle_t;
+
+struct NativeTaskDeleted {};
+
+inline NativeTask *& nativeCurrentTask() {
+	static thread_local NativeTask * task = nullptr;
+	return task;
+}
+
+inline TickType_t xTaskGetTickCount() {
+	using namespace std::chrono;
+	static auto start = steady_clock::now();
+	return duration_cast<milliseconds>(steady_clock::now() - start).count() / portTICK_PERIOD_MS;
+}
+
+inline TickType_t xTaskGetTickCountFromISR() {
+	return xTaskGetTickCount();
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+	auto task = nativeCurrentTask();
+	auto duration = std::chrono::milliseconds(ticks * portTICK_PERIOD_MS);
+	if (!task) {
+		std::this_thread::sleep_for(duration);
+		return;
+	}
+	std::unique_lock<std::mutex> lock(task->mutex);
+	task->blocked = true;
+	task->signal.notify_all();
+	task->signal.wait_for(lock, duration, [task] { return task->aborted || task->deleted; });
+	task->aborted = false;
+	if (task->deleted) {
+		throw NativeTaskDeleted();
+	}
+}
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char * name, uint32_t stackDepth,
+	void * parameters, UBaseType_t priority, TaskHandle_t * handle, BaseType_t core)
+{
+	auto task = new NativeTask();
+	if (handle) {
+		*handle = task;
+	}
+	std::thread([task, function, parameters] {
+		nativeCurrentTask() = task;
+		try {
+			function(parameters);
+		} catch (NativeTaskDeleted &) {
+		}
+		std::lock_guard<std::mutex> lock(task->mutex);
+		task->stopped = true;
+		task->signal.notify_all();
+	}).detach();
+
+	// let the new task run until it blocks, so it can pick up its parameters
+	std::unique_lock<std::mutex> lock(task->mutex);
+	task->signal.wait(lock, [task] { return task->blocked || task->stopped; });
+	return pdPASS;
+}
+
+inline BaseType_t xTaskAbortDelay(TaskHandle_t task) {
+	std::lock_guard<std::mutex> lock(task->mutex);
+	task->aborted = true;
+	task->signal.notify_all();
+	return pdPASS;
+}
+
+inline void vTaskDelete(TaskHandle_t task) {
+	if (!task || task == nativeCurrentTask()) {
+		throw NativeTaskDeleted();
+	}
+	std::unique_lock<std::mutex> lock(task->mutex);
+	task->deleted = true;
+	task->signal.notify_all();
+	task->signal.wait(lock, [task] { return task->stopped; });
+}
+
+#endif // NATIVE_FREERTOS_H
@@ -0,0 +1,882 @@
+//
+// Title:			Agon Video BIOS - Native host harness
+// Created:			17/10/2026
+//
+// Builds the VDP's protocol, buffer, audio and teletext code for a Linux host
+// (see the native environment in platformio.ini), so the hot paths can be
+// benchmarked and fuzzed without an ESP32
+//
+// Usage:
+//   program					Run all of the benchmarks
+//   program bench <name>		Run one benchmark (text, plot, frame, lz4frame, buffers, loop, buffercounter,
+//								registercounter, patchcall, argscall, smallbuffers, adjust, adjustblocks, splitby, audio,
+//								teletext, map-insert, table-insert, map-lookup, table-lookup)
+//   program test [<name>]		Run all of the tests, or just one (argsheaders, argskept, processnext, stall,
+//								resync, running, selfchange)
+//   program run <file>		Process a file of VDU bytes, or stdin if the file is "-"
+//
+// Benchmarks check their results before they're timed, and the program exits with 1 if any check fails
+//
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <fabgl.h>
+
+#define	DEBUG			0						// Serial Debug Mode: 1 = enable
+#define SERIALBAUDRATE	115200
+
+HardwareSerial	DBGSerial(0);
+HardwareSerial	Serial2(2);
+
+bool			terminalMode = false;			// Terminal mode (for CP/M)
+bool			consoleMode = false;			// Serial console mode (0 = off, 1 = console enabled)
+
+#include "../agon.h"							// Configuration file
+#include "../agon_ps2.h"						// Keyboard support
+#include "../agon_audio.h"						// Audio support
+#include "../agon_ttxt.h"
+#include "../graphics.h"						// Graphics support
+#include "../cursor.h"							// Cursor support
+#include "../vdp_protocol.h"					// VDP Protocol
+#include "../vdu_stream_processor.h"
+#include "../hexload.h"
+
+VDUStreamProcessor *	processor;				// VDU Stream Processor
+
+// Output stream that counts and discards everything sent to the eZ80
+//
+class NullStream : public Stream {
+	public:
+		int available() { return 0; }
+		int read() { return -1; }
+		int peek() { return -1; }
+		size_t write(uint8_t b) {
+			written++;
+			checksum = checksum * 31 + b;
+			if (recording) {
+				recording->push_back(b);
+			}
+			return 1;
+		}
+		size_t write(const uint8_t * data, size_t length) {
+			for (size_t i = 0; i < length; i++) {
+				write(data[i]);
+			}
+			return length;
+		}
+
+		uint32_t written = 0;
+		uint32_t checksum = 0;						// Lets runs of the same input be compared
+		std::vector<uint8_t> * recording = nullptr;	// Where to keep a copy of what's written, if anywhere
+};
+
+// Builds a stream of VDU bytes
+//
+class VDUBytes {
+	public:
+		VDUBytes & b(uint8_t value) { data.push_back(value); return *this; }
+		VDUBytes & w(uint16_t value) { return b(value & 0xFF).b(value >> 8); }
+		VDUBytes & bytes(std::initializer_list<uint8_t> values) { data.insert(data.end(), values); return *this; }
+		VDUBytes & text(const char * s) { while (*s) b(*s++); return *this; }
+		VDUBytes & append(const VDUBytes & other) { data.insert(data.end(), other.data.begin(), other.data.end()); return *this; }
+		VDUBytes & buffered(uint16_t bufferId, uint8_t command) { return bytes({ 23, 0, VDP_BUFFERED }).w(bufferId).b(command); }
+
+		std::vector<uint8_t> data;
+};
+
+std::shared_ptr<NullStream> output = std::make_shared<NullStream>();
+
+// Compress a block of bytes in the LZ4 block format, as a host would before sending it
+// This is a simple greedy compressor, so doesn't compress as well as the LZ4 library
+//
+std::vector<uint8_t> lz4Compress(const std::vector<uint8_t> & in) {
+	std::vector<uint8_t> out;
+	std::vector<int32_t> table(4096, -1);
+	size_t length = in.size();
+	size_t anchor = 0;
+	size_t i = 0;
+
+	auto writeLength = [&out](size_t value) {
+		while (value >= 255) {
+			out.push_back(255);
+			value -= 255;
+		}
+		out.push_back(value);
+	};
+	auto writeLiterals = [&](size_t end, size_t matchLength) {
+		size_t literals = end - anchor;
+		uint8_t matchToken = matchLength ? std::min<size_t>(matchLength - 4, 15) : 0;
+		out.push_back((std::min<size_t>(literals, 15) << 4) | matchToken);
+		if (literals >= 15) {
+			writeLength(literals - 15);
+		}
+		out.insert(out.end(), in.begin() + anchor, in.begin() + end);
+	};
+
+	// the format requires the last match to start at least 12 bytes before the end,
+	// and the last 5 bytes to be literals
+	while (i + 12 <= length) {
+		uint32_t sequence;
+		memcpy(&sequence, &in[i], 4);
+		auto hash = (sequence * 2654435761u) >> 20;
+		auto candidate = table[hash];
+		table[hash] = i;
+		if (candidate < 0 || i - candidate > 65535 || memcmp(&in[candidate], &in[i], 4) != 0) {
+			i++;
+			continue;
+		}
+		size_t matchLength = 4;
+		while (i + matchLength + 5 < length && in[candidate + matchLength] == in[i + matchLength]) {
+			matchLength++;
+		}
+		auto offset = i - candidate;
+		writeLiterals(i, matchLength);
+		out.push_back(offset & 0xFF);
+		out.push_back(offset >> 8);
+		if (matchLength - 4 >= 15) {
+			writeLength(matchLength - 4 - 15);
+		}
+		i += matchLength;
+		anchor = i;
+	}
+	writeLiterals(length, 0);
+	return out;
+}
+
+// Run a block of VDU bytes through a stream processor until it is exhausted
+//
+void process(const uint8_t * data, size_t length) {
+	if (length == 0) {
+		return;
+	}
+	auto input = make_shared_psram<BufferStream>(length);
+	input->writeBuffer((uint8_t *)data, length, 0);
+	VDUStreamProcessor streamProcessor(input, output, 65535);
+	streamProcessor.processAllAvailable();
+	VDPPacketWriter.flush();
+}
+
+void process(const std::vector<uint8_t> & data) {
+	process(data.data(), data.size());
+}
+
+// Benchmarks
+// Each builds its input once, then times repeated runs of it
+// A benchmark can also check what a run did, which is done once before it's timed
+//
+struct Benchmark {
+	const char *					name;
+	std::function<void()>			setup;
+	std::function<void()>			run;
+	std::function<bool()>			check;
+	uint32_t						iterations;
+	uint32_t						bytes;
+};
+
+// Make a value look used to the optimiser, so the work that produced it isn't skipped
+//
+template<typename T>
+inline void keep(const T & value) {
+	asm volatile("" : : "g"(value) : "memory");
+}
+
+// A benchmark that processes a block of VDU bytes, in a fresh screen mode if clearScreen is set
+//
+Benchmark vduBenchmark(const char * name, const VDUBytes & input, bool clearScreen, std::function<bool()> check = nullptr, uint32_t iterations = 200) {
+	std::function<void()> setup;
+	if (clearScreen) {
+		setup = [] { process({ 22, 1 }); };
+	}
+	auto data = &input.data;
+	return { name, setup, [data] { process(*data); }, check, iterations, (uint32_t)data->size() };
+}
+
+// The bytes sent to the eZ80 while processing a block of VDU bytes
+//
+std::vector<uint8_t> outputOf(const std::vector<uint8_t> & data) {
+	std::vector<uint8_t> sent;
+	output->recording = &sent;
+	process(data);
+	output->recording = nullptr;
+	return sent;
+}
+
+// The contents of a buffer, across all of its blocks
+//
+std::vector<uint8_t> bufferContents(uint16_t bufferId) {
+	std::vector<uint8_t> contents;
+	auto buffer = buffers.find(bufferId);
+	if (buffer != buffers.end()) {
+		for (auto & block : buffer->second) {
+			contents.insert(contents.end(), block->getBuffer(), block->getBuffer() + block->size());
+		}
+	}
+	return contents;
+}
+
+// Wrap VDU bytes in a checksummed frame, compressing them first if asked to
+//
+VDUBytes makeFrame(const VDUBytes & input, bool compressed) {
+	VDUBytes frame;
+	auto & data = input.data;
+	if (compressed) {
+		auto packed = lz4Compress(data);
+		frame.bytes({ 23, 0, VDP_COMPRESSED_FRAME }).w(packed.size()).w(data.size());
+		frame.data.insert(frame.data.end(), packed.begin(), packed.end());
+	} else {
+		frame.bytes({ 23, 0, VDP_FRAME }).w(data.size());
+		frame.data.insert(frame.data.end(), data.begin(), data.end());
+	}
+	uint8_t sum = 0;
+	for (size_t i = compressed ? 7 : 5; i < frame.data.size(); i++) {
+		sum += frame.data[i];
+	}
+	return frame.b(-sum);
+}
+
+// Registry benchmarks, comparing the ID table used for buffers against the map it replaced
+// IDs are a run of low numbers plus a run high up, as the MOS and BASIC tend to use
+//
+std::vector<uint16_t> registryIds() {
+	std::vector<uint16_t> ids;
+	for (int i = 0; i < 256; i++) {
+		ids.push_back(i);
+		ids.push_back(0xFA00 + i * 3);
+	}
+	return ids;
+}
+
+template<typename Registry>
+void registryInsert(Registry & registry, const std::vector<uint16_t> & ids) {
+	registry.clear();
+	for (auto id : ids) {
+		registry[id].clear();
+	}
+}
+
+// Returns the number of IDs found, which the benchmarks keep so the lookups aren't optimised away
+//
+template<typename Registry>
+size_t registryLookup(Registry & registry, const std::vector<uint16_t> & ids) {
+	size_t found = 0;
+	for (int pass = 0; pass < 16; pass++) {
+		for (auto id : ids) {
+			found += registry.find(id) != registry.end();
+			// and a miss
+			found += registry.find(id + 0x100) != registry.end();
+		}
+	}
+	return found;
+}
+
+std::vector<Benchmark> benchmarks() {
+	static std::unordered_map<uint16_t, BufferBlocks> registryMap;
+	static IdTable<BufferBlocks> registryTable;
+	static auto ids = registryIds();
+	static VDUBytes text, plot, frame, compressedFrame, polls, pollFrame, compressedPollFrame,
+		program, inlineProgram, bufferCalls, bufferLoop, bufferCounter, registerCounter, patchCall, argsCall, calledPolls,
+		smallBuffers, adjust, adjustBlocks, splitBy, audio, teletext;
+	static std::vector<uint8_t> splitData;
+
+	for (int line = 0; line < 64; line++) {
+		text.text("The quick brown fox jumps over the lazy dog 0123456789!").bytes({ 13, 10 });
+	}
+
+	for (int i = 0; i < 1024; i++) {
+		plot.b(25).b(4).w(i % 1280).w((i * 7) % 1024);				// MOVE
+		plot.b(25).b(5).w((i * 13) % 1280).w((i * 3) % 1024);		// DRAW
+		plot.b(25).b(85).w((i * 5) % 1280).w((i * 11) % 1024);		// Triangle
+	}
+
+	// the same plot commands, sent as a single checksummed frame, and as a compressed frame
+	// frames of general polls check that a frame runs just as its contents would
+	frame = makeFrame(plot, false);
+	compressedFrame = makeFrame(plot, true);
+	for (int i = 0; i < 256; i++) {
+		polls.bytes({ 23, 0, VDP_GP }).b(i);
+	}
+	pollFrame = makeFrame(polls, false);
+	compressedPollFrame = makeFrame(polls, true);
+
+	// buffer 1 holds a short program ending with a general poll, which is then called repeatedly
+	for (int i = 0; i < 16; i++) {
+		program.b(25).b(69).w(i * 64).w(i * 32);					// Point
+	}
+	program.bytes({ 23, 0, VDP_GP }).b(1);
+	bufferCalls.buffered(1, BUFFERED_CLEAR);
+	bufferCalls.buffered(1, BUFFERED_WRITE).w(program.data.size()).append(program);
+	for (int i = 0; i < 256; i++) {
+		bufferCalls.buffered(1, BUFFERED_CALL);
+		inlineProgram.append(program);
+	}
+
+	// the same program, called the same number of times by a single loop command
+	bufferLoop.buffered(1, BUFFERED_CLEAR);
+	bufferLoop.buffered(1, BUFFERED_WRITE).w(program.data.size()).append(program);
+	bufferLoop.buffered(1, BUFFERED_LOOP).w(256);
+
+	// buffer 9 draws a line and sends a general poll, with the line's coordinates and the poll's
+	// byte either patched in before calling it, or given as arguments
+	VDUBytes line;
+	line.b(25).b(4).w(0).w(0).b(25).b(5).w(0).w(0).bytes({ 23, 0, VDP_GP }).b(0);
+	uint8_t lineOffsets[] = { 2, 4, 8, 10, 15 };
+	uint8_t lineWidths[] = { 2, 2, 2, 2, 1 };
+	for (auto calls : { &patchCall, &argsCall }) {
+		calls->buffered(9, BUFFERED_CLEAR);
+		calls->buffered(9, BUFFERED_WRITE).w(line.data.size()).append(line);
+	}
+	argsCall.buffered(9, BUFFERED_SET_PARAMETERS);
+	for (int i = 0; i < 5; i++) {
+		argsCall.w(lineOffsets[i]).b(i).b(lineWidths[i]);
+	}
+	argsCall.w(65535);
+	for (int i = 0; i < 256; i++) {
+		uint16_t values[] = { (uint16_t)(i * 4), (uint16_t)(i * 3), (uint16_t)(1279 - i * 4), (uint16_t)(1023 - i * 3), (uint16_t)i };
+		for (int j = 0; j < 5; j++) {
+			patchCall.buffered(9, BUFFERED_ADJUST).b(ADJUST_SET | ADJUST_MULTI_TARGET | ADJUST_MULTI_OPERAND)
+				.w(lineOffsets[j]).w(lineWidths[j]);
+			for (int k = 0; k < lineWidths[j]; k++) {
+				patchCall.b(values[j] >> (k * 8));
+			}
+		}
+		patchCall.buffered(9, BUFFERED_CALL);
+		argsCall.buffered(9, BUFFERED_CALL_ARGS).b(5);
+		for (auto value : values) {
+			argsCall.w(value);
+		}
+		calledPolls.bytes({ 23, 0, VDP_GP }).b(i);
+	}
+
+	// a loop that counts in buffer 5, checking the count each time round
+	VDUBytes counterBody;
+	counterBody.buffered(5, BUFFERED_ADJUST).b(ADJUST_ADD_32).w(0).w(1).w(0);
+	counterBody.buffered(1, BUFFERED_COND_CALL).b(COND_EQUAL | COND_32BIT).w(5).w(0).w(65535).w(65535);
+	bufferCounter.buffered(5, BUFFERED_CLEAR);
+	bufferCounter.buffered(5, BUFFERED_CREATE).w(4);
+	bufferCounter.buffered(6, BUFFERED_CLEAR);
+	bufferCounter.buffered(6, BUFFERED_WRITE).w(counterBody.data.size()).append(counterBody);
+	bufferCounter.buffered(6, BUFFERED_LOOP).w(256);
+
+	// the same loop, counting in a register
+	VDUBytes registerBody;
+	registerBody.buffered(65535, BUFFERED_REGISTER).b(REG_ADD).b(0).b(1);
+	registerBody.buffered(1, BUFFERED_REG_COND_CALL).b(COND_EQUAL | REG_32BIT).b(0).w(65535).w(65535);
+	registerCounter.buffered(65535, BUFFERED_REGISTER).b(REG_SET).b(0).b(0);
+	registerCounter.buffered(7, BUFFERED_CLEAR);
+	registerCounter.buffered(7, BUFFERED_WRITE).w(registerBody.data.size()).append(registerBody);
+	registerCounter.buffered(7, BUFFERED_LOOP).w(256);
+
+	// 256 small buffers, written and then all cleared
+	for (int i = 0; i < 256; i++) {
+		smallBuffers.buffered(0x100 + i, BUFFERED_WRITE).w(16 + i % 16);
+		for (int j = 0; j < 16 + i % 16; j++) {
+			smallBuffers.b(j);
+		}
+	}
+	smallBuffers.buffered(65535, BUFFERED_CLEAR);
+
+	// buffer 2 is 256 bytes, adjusted in place with multi-target adds
+	adjust.buffered(2, BUFFERED_CLEAR);
+	adjust.buffered(2, BUFFERED_CREATE).w(256);
+	for (int i = 0; i < 256; i++) {
+		adjust.buffered(2, BUFFERED_ADJUST).b(ADJUST_ADD | ADJUST_MULTI_TARGET).w(0).w(256).b(i);
+	}
+
+	// buffer 3 is built from 256 single byte writes, then adjusted as a whole
+	adjustBlocks.buffered(3, BUFFERED_CLEAR);
+	for (int i = 0; i < 256; i++) {
+		adjustBlocks.buffered(3, BUFFERED_WRITE).w(1).b(i);
+	}
+	for (int i = 0; i < 16; i++) {
+		adjustBlocks.buffered(3, BUFFERED_ADJUST).b(ADJUST_ADD | ADJUST_MULTI_TARGET).w(0).w(256).b(i);
+	}
+
+	// buffer 4 is 4096 bytes of 4 channels, split into one buffer per channel and interleaved back again
+	for (int i = 0; i < 4096; i++) {
+		splitData.push_back(i * 7);
+	}
+	splitBy.buffered(4, BUFFERED_CLEAR);
+	splitBy.buffered(4, BUFFERED_WRITE).w(splitData.size());
+	splitBy.data.insert(splitBy.data.end(), splitData.begin(), splitData.end());
+	for (int i = 0; i < 8; i++) {
+		splitBy.buffered(4, BUFFERED_SPLIT_BY_INTO).w(1).w(0x200).w(0x201).w(0x202).w(0x203).w(65535);
+		splitBy.buffered(4, BUFFERED_INTERLEAVE_FROM).w(1).w(4).w(0x200);
+	}
+
+	// volume and frequency envelopes on channel 0, then a run of short notes
+	audio.bytes({ 23, 0, VDP_AUDIO, 0, AUDIO_CMD_ENV_VOLUME, AUDIO_ENVELOPE_ADSR }).w(10).w(20).b(100).w(30);
+	audio.bytes({ 23, 0, VDP_AUDIO, 0, AUDIO_CMD_ENV_FREQUENCY, AUDIO_FREQUENCY_ENVELOPE_STEPPED, 2, AUDIO_FREQUENCY_REPEATS }).w(5);
+	audio.w(10).w(4).w(-10).w(4);
+	for (int i = 0; i < 64; i++) {
+		audio.bytes({ 23, 0, VDP_AUDIO, 0, AUDIO_CMD_PLAY, 64 }).w(220 + i * 10).w(1);
+		audio.bytes({ 23, 0, VDP_AUDIO, 0, AUDIO_CMD_STATUS });
+	}
+
+	teletext.bytes({ 22, 7 });
+	for (int line = 0; line < 24; line++) {
+		teletext.b(129 + line % 7).text("Teletext ").b(141).text("double height ").b(156).text("and mosaics").bytes({ 13, 10 });
+	}
+
+	return {
+		vduBenchmark("text", text, true),
+		vduBenchmark("plot", plot, true),
+		vduBenchmark("frame", frame, true, [] { return outputOf(pollFrame.data) == outputOf(polls.data); }),
+		vduBenchmark("lz4frame", compressedFrame, true, [] { return outputOf(compressedPollFrame.data) == outputOf(polls.data); }),
+		vduBenchmark("buffers", bufferCalls, true, [] { return outputOf(bufferCalls.data) == outputOf(inlineProgram.data); }),
+		vduBenchmark("loop", bufferLoop, true, [] { return outputOf(bufferLoop.data) == outputOf(inlineProgram.data); }),
+		vduBenchmark("buffercounter", bufferCounter, false, [] {
+			process(bufferCounter.data);
+			return bufferContents(5) == std::vector<uint8_t> { 0, 1, 0, 0 };
+		}),
+		vduBenchmark("registercounter", registerCounter, false, [] {
+			process(registerCounter.data);
+			return bufferRegisters[0] == 256;
+		}),
+		vduBenchmark("patchcall", patchCall, true, [] { return outputOf(patchCall.data) == outputOf(calledPolls.data); }),
+		vduBenchmark("argscall", argsCall, true, [] { return outputOf(argsCall.data) == outputOf(calledPolls.data); }),
+		vduBenchmark("smallbuffers", smallBuffers, false, [] {
+			process(smallBuffers.data);
+			return buffers.find(0x100) == buffers.end();
+		}),
+		vduBenchmark("adjust", adjust, false, [] {
+			process(adjust.data);
+			// every byte has had 0 to 255 added to it
+			return bufferContents(2) == std::vector<uint8_t>(256, 128);
+		}),
+		vduBenchmark("adjustblocks", adjustBlocks, false, [] {
+			process(adjustBlocks.data);
+			auto contents = bufferContents(3);
+			for (size_t i = 0; i < contents.size(); i++) {
+				if (contents[i] != (uint8_t)(i + 120)) {
+					return false;
+				}
+			}
+			return contents.size() == 256;
+		}),
+		vduBenchmark("splitby", splitBy, false, [] {
+			process(splitBy.data);
+			return bufferContents(4) == splitData;
+		}),
+		vduBenchmark("audio", audio, false, nullptr, 20),
+		vduBenchmark("teletext", teletext, false),
+		{ "map-insert", nullptr, [] { registryInsert(registryMap, ids); }, nullptr, 200, (uint32_t)ids.size() },
+		{ "table-insert", nullptr, [] { registryInsert(registryTable, ids); }, nullptr, 200, (uint32_t)ids.size() },
+		{ "map-lookup", [] { registryInsert(registryMap, ids); }, [] { keep(registryLookup(registryMap, ids)); },
+			[] { return registryLookup(registryMap, ids) == ids.size() * 16; }, 200, (uint32_t)ids.size() * 32 },
+		{ "table-lookup", [] { registryInsert(registryTable, ids); }, [] { keep(registryLookup(registryTable, ids)); },
+			[] { return registryLookup(registryTable, ids) == ids.size() * 16; }, 200, (uint32_t)ids.size() * 32 },
+	};
+}
+
+// Returns false if the benchmark's check failed, in which case it isn't timed
+//
+bool runBenchmark(Benchmark & benchmark) {
+	if (benchmark.setup) {
+		benchmark.setup();
+	}
+	if (benchmark.check && !benchmark.check()) {
+		printf("%-10s check FAILED\n", benchmark.name);
+		return false;
+	}
+	benchmark.run();											// Warm up
+	auto start = micros();
+	for (uint32_t i = 0; i < benchmark.iterations; i++) {
+		benchmark.run();
+	}
+	auto elapsed = std::max<unsigned long>(micros() - start, 1);
+	auto perRun = (double)elapsed / benchmark.iterations;
+	printf("%-10s %8u bytes %10.1f us/run %10.2f MB/s\n", benchmark.name, benchmark.bytes, perRun,
+		(double)benchmark.bytes * benchmark.iterations / elapsed);
+	return true;
+}
+
+// Tests
+// Checks of behaviour that the benchmarks don't cover, each returning true if it passed
+//
+struct Test {
+	const char *					name;
+	std::function<bool()>			run;
+};
+
+// Call a buffer with arguments that fall on the bytes identifying its commands, as well as their arguments
+// The buffer is called both from its decoded version and, as a writable buffer, from its blocks,
+// and both must behave as the substituted bytes would if they were sent directly
+//
+bool testArgumentsOnHeaders() {
+	VDUBytes program;
+	program.b('A').bytes({ 23, 0, VDP_GP }).b(0);
+	uint8_t offsets[] = { 0, 3, 4 };
+	VDUBytes calls, expected;
+	for (uint16_t bufferId : { 20, 21 }) {
+		calls.buffered(bufferId, BUFFERED_CLEAR);
+		if (bufferId == 20) {
+			calls.buffered(bufferId, BUFFERED_WRITE).w(program.data.size()).append(program);
+		} else {
+			calls.buffered(bufferId, BUFFERED_CREATE).w(program.data.size());
+			calls.buffered(bufferId, BUFFERED_ADJUST).b(ADJUST_SET | ADJUST_MULTI_TARGET | ADJUST_MULTI_OPERAND)
+				.w(0).w(program.data.size()).append(program);
+		}
+		calls.buffered(bufferId, BUFFERED_SET_PARAMETERS);
+		for (int i = 0; i < 3; i++) {
+			calls.w(offsets[i]).b(i).b(1);
+		}
+		calls.w(65535);
+	}
+	// the same buffer is called with different arguments, and a mode byte that isn't a general poll
+	uint8_t modes[] = { VDP_GP, VDP_GP, VDP_CURSOR };
+	for (int i = 0; i < 3; i++) {
+		for (uint16_t bufferId : { 20, 21 }) {
+			calls.buffered(bufferId, BUFFERED_CALL_ARGS).b(3).w('B' + i).w(modes[i]).w(0x40 + i);
+			expected.b('B' + i).bytes({ 23, 0, modes[i] }).b(0x40 + i);
+		}
+	}
+	process({ 22, 1 });
+	auto called = outputOf(calls.data);
+	process({ 22, 1 });
+	return !called.empty() && called == outputOf(expected.data);
+}
+
+// A buffer's parameters last while its contents are changed in place or added to,
+// and go once it's cleared
+//
+bool testParametersKept() {
+	VDUBytes program, calls, expected;
+	program.bytes({ 23, 0, VDP_GP }).b(0);
+	calls.buffered(22, BUFFERED_CLEAR);
+	calls.buffered(22, BUFFERED_WRITE).w(program.data.size()).append(program);
+	calls.buffered(22, BUFFERED_SET_PARAMETERS).w(3).b(0).b(1).w(65535);
+	calls.buffered(22, BUFFERED_CALL_ARGS).b(1).w(0x51);
+	expected.bytes({ 23, 0, VDP_GP, 0x51 });
+	calls.buffered(22, BUFFERED_ADJUST).b(ADJUST_SET).w(3).b(0x20);
+	calls.buffered(22, BUFFERED_CALL_ARGS).b(1).w(0x52);
+	expected.bytes({ 23, 0, VDP_GP, 0x52 });
+	calls.buffered(22, BUFFERED_WRITE).w(program.data.size()).append(program);
+	calls.buffered(22, BUFFERED_CALL_ARGS).b(1).w(0x53);
+	expected.bytes({ 23, 0, VDP_GP, 0x53, 23, 0, VDP_GP, 0 });
+	calls.buffered(22, BUFFERED_CLEAR);
+	calls.buffered(22, BUFFERED_WRITE).w(program.data.size()).append(program);
+	calls.buffered(22, BUFFERED_CALL_ARGS).b(1).w(0x54);
+	expected.bytes({ 23, 0, VDP_GP, 0 });
+	auto called = outputOf(calls.data);
+	return !called.empty() && called == outputOf(expected.data);
+}
+
+// Input stream whose bytes only become available as they're released,
+// as they would from a host that sends a few at a time
+//
+class TrickleStream : public Stream {
+	public:
+		TrickleStream(const std::vector<uint8_t> & data) : data(data) {}
+		int available() { return released - position; }
+		int read() { return position < released ? data[position++] : -1; }
+		int peek() { return position < released ? data[position] : -1; }
+		size_t write(uint8_t b) { return 0; }
+
+		void release(size_t count) {
+			released = std::min(released + count, data.size());
+		}
+		inline bool finished() {
+			return position == data.size();
+		}
+
+	private:
+		std::vector<uint8_t> data;
+		size_t released = 0;
+		size_t position = 0;
+};
+
+// A stream processor reading from a TrickleStream, recording what it sends
+//
+struct TrickleRun {
+	TrickleRun(const std::vector<uint8_t> & data) : input(std::make_shared<TrickleStream>(data)), processor(input, output, 65535) {
+		output->recording = &sent;
+	}
+	~TrickleRun() {
+		output->recording = nullptr;
+	}
+	// Release count bytes before each call of processNext, until everything has been processed
+	bool finish(size_t count) {
+		for (auto calls = 0; calls < 100000; calls++) {
+			if (input->finished() && !processor.commandPending()) {
+				return true;
+			}
+			input->release(count);
+			processor.processNext();
+			pendingSeen |= processor.commandPending();
+		}
+		return false;
+	}
+
+	std::shared_ptr<TrickleStream> input;
+	VDUStreamProcessor processor;
+	std::vector<uint8_t> sent;
+	bool pendingSeen = false;
+};
+
+// Feed processNext a few bytes per call, which must give the same replies as processing them all at once
+// Commands left waiting for their bytes must show as pending
+//
+bool testProcessNext() {
+	VDUBytes input;
+	input.text("Trickle").bytes({ 13, 10 });
+	input.bytes({ 17, 2, 18, 0, 3, 31, 3, 4 });								// COLOUR, GCOL and TAB
+	for (int i = 0; i < 8; i++) {
+		input.b(25).b(69).w(i * 40).w(i * 30);								// Point
+		input.bytes({ 23, 0, VDP_GP }).b(i);
+	}
+	input.bytes({ 23, 0, VDP_CURSOR });
+	input.bytes({ 23, 0, VDP_SCRCHAR }).w(0).w(0);
+	input.bytes({ 23, 1, 1 });												// Cursor on
+	process({ 22, 1 });
+	auto expected = outputOf(input.data);
+	for (size_t count : { 1, 2, 3, 7 }) {
+		process({ 22, 1 });
+		TrickleRun run(input.data);
+		if (!run.finish(count) || run.sent != expected || (count < 3 && !run.pendingSeen)) {
+			return false;
+		}
+	}
+	return !expected.empty();
+}
+
+// A sender that stalls part-way through a command's header, or its arguments, has it dispatched
+// once COMMS_TIMEOUT has passed, so that what follows it is still processed
+//
+bool testProcessNextStall() {
+	VDUBytes input, poll;
+	input.b(23);
+	auto stalledHeader = input.data.size();
+	input.b(25).b(69).w(10);
+	auto stalledArguments = input.data.size();
+	poll.bytes({ 23, 0, VDP_GP }).b(0x33);
+	input.append(poll);
+	auto expected = outputOf(poll.data);
+	TrickleRun run(input.data);
+	for (auto stalled : { stalledHeader, stalledArguments - stalledHeader }) {
+		run.input->release(stalled);
+		run.processor.processNext();
+		if (!run.processor.commandPending() || !run.sent.empty()) {
+			return false;
+		}
+		delay(COMMS_TIMEOUT + 10);
+		run.processor.processNext();
+		if (run.processor.commandPending()) {
+			return false;
+		}
+	}
+	return run.finish(1) && run.sent == expected;
+}
+
+// Once the host has sent a resync marker, a command that times out because bytes were lost
+// reports a desync, and everything up to the next complete marker is discarded before
+// a resync is reported and commands run again
+//
+bool testResync() {
+	const std::vector<uint8_t> marker = RESYNC_MARKER;
+	VDUBytes input, lost, poll, expected;
+	input.data = marker;
+	input.b(25).b(69).w(10);												// Point, missing its y coordinate
+	// a general poll that must be discarded, and a marker that's cut short
+	lost.bytes({ 23, 0, VDP_GP, 0x11 }).bytes({ 23, 0, VDP_RESYNC, 'S', 'Y' }).b('x');
+	poll.bytes({ 23, 0, VDP_GP }).b(0x22);
+	uint32_t discarded = lost.data.size() + marker.size();
+	expected.bytes({ 0x80 | PACKET_RESYNC, 8, RESYNC_EVENT_DESYNC, 25, 0, 0, 0, 0, 0, 0 });
+	expected.bytes({ 0x80 | PACKET_RESYNC, 8, RESYNC_EVENT_RESYNC, 0, 0, 0 }).w(discarded).w(0);
+	auto sentBefore = input.data.size();
+	input.append(lost);
+	input.data.insert(input.data.end(), marker.begin(), marker.end());
+	input.append(poll);
+	auto reply = outputOf(poll.data);
+	expected.data.insert(expected.data.end(), reply.begin(), reply.end());
+
+	TrickleRun run(input.data);
+	run.input->release(sentBefore);
+	while (run.input->available() > 0) {
+		run.processor.processNext();
+	}
+	delay(COMMS_TIMEOUT + 10);
+	run.processor.processNext();
+	return run.finish(3) && run.sent == expected.data;
+}
+
+// A cacheable buffer that makes room for a write while it's running must not evict itself,
+// even though each command it runs moves the buffer clock on
+//
+bool testRunningNotEvicted() {
+	VDUBytes setup, program, call;
+	program.buffered(31, BUFFERED_WRITE).w(250);
+	program.data.resize(program.data.size() + 250);
+	program.bytes({ 23, 0, VDP_GP }).b(0x44);
+	setup.buffered(65535, BUFFERED_CLEAR);
+	setup.buffered(32, BUFFERED_WRITE).w(100);
+	setup.data.resize(setup.data.size() + 100);
+	setup.buffered(30, BUFFERED_WRITE).w(program.data.size()).append(program);
+	for (uint16_t bufferId : { 32, 30 }) {
+		setup.buffered(bufferId, BUFFERED_SET_CACHEABLE).b(1);
+	}
+	process(setup.data);
+	call.buffered(30, BUFFERED_CALL);
+	// room for the call's own input and a bit more, but not for the write unless both buffers go
+	bufferDataQuota = bufferDataBytes + call.data.size() + 100;
+	process(call.data);
+	bufferDataQuota = 0;
+	return buffers.find(32) == buffers.end() && !bufferContents(30).empty();
+}
+
+// A single block buffer that changes itself while it's running keeps reading its current contents,
+// even when the change gives the block new contents and the old ones are freed
+// Here the buffer shares its contents with a cacheable copy, so changing it takes a copy of its own,
+// and making room for that evicts the copy, leaving the running buffer with the only reference to the old contents
+//
+bool testSelfChangeUnshares() {
+	VDUBytes setup, program, call, expected;
+	program.buffered(33, BUFFERED_ADJUST).b(ADJUST_SET | ADJUST_MULTI_TARGET | ADJUST_MULTI_OPERAND).w(0).w(2);
+	auto operands = program.data.size();
+	program.bytes({ 0, 0 });
+	program.bytes({ 23, 0, VDP_GP }).b(0x55);
+	// the adjust sets the buffer's first two bytes to what they already are
+	program.data[operands] = program.data[0];
+	program.data[operands + 1] = program.data[1];
+	setup.buffered(65535, BUFFERED_CLEAR);
+	setup.buffered(33, BUFFERED_WRITE).w(program.data.size()).append(program);
+	setup.buffered(34, BUFFERED_COPY).w(33).w(65535);
+	setup.buffered(35, BUFFERED_WRITE).w(100);
+	setup.data.resize(setup.data.size() + 100);
+	for (uint16_t bufferId : { 34, 35 }) {
+		setup.buffered(bufferId, BUFFERED_SET_CACHEABLE).b(1);
+	}
+	process(setup.data);
+	call.buffered(33, BUFFERED_CALL);
+	expected.bytes({ 23, 0, VDP_GP }).b(0x55);
+	auto reply = outputOf(expected.data);
+	// the new contents only fit once both cacheable buffers have gone
+	bufferDataQuota = bufferDataBytes + call.data.size() + program.data.size() / 2;
+	auto sent = outputOf(call.data);
+	bufferDataQuota = 0;
+	// the reply follows the report of the evicted buffers
+	return sent.size() > reply.size() && std::equal(reply.begin(), reply.end(), sent.end() - reply.size())
+		&& buffers.find(35) == buffers.end() && bufferContents(33) == program.data;
+}
+
+std::vector<Test> tests() {
+	return {
+		{ "argsheaders", testArgumentsOnHeaders },
+		{ "argskept", testParametersKept },
+		{ "processnext", testProcessNext },
+		{ "stall", testProcessNextStall },
+		{ "resync", testResync },
+		{ "running", testRunningNotEvicted },
+		{ "selfchange", testSelfChangeUnshares },
+	};
+}
+
+void process(const char * filename) {
+	auto file = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "rb");
+	if (!file) {
+		perror(filename);
+		exit(1);
+	}
+	std::vector<uint8_t> data;
+	uint8_t chunk[4096];
+	size_t length;
+	while ((length = fread(chunk, 1, sizeof chunk, file)) > 0) {
+		data.insert(data.end(), chunk, chunk + length);
+	}
+	if (file != stdin) {
+		fclose(file);
+	}
+	process(data);
+	printf("Processed %u bytes, sent %u bytes, checksum %08x\n", (uint32_t)data.size(), output->written, output->checksum);
+}
+
+int main(int argc, char * argv[]) {
+	processor = new VDUStreamProcessor(output, output, 65535);
+	VDPPacketWriter.begin(output.get());
+	setupKeyboardAndMouse();
+	init_audio();
+	copy_font();
+	set_mode(1);
+
+	bool failed = false;
+	if (argc >= 3 && strcmp(argv[1], "run") == 0) {
+		process(argv[2]);
+	} else if (argc >= 2 && strcmp(argv[1], "test") == 0) {
+		auto all = tests();
+		for (auto & test : all) {
+			if (argc < 3 || strcmp(argv[2], test.name) == 0) {
+				auto passed = test.run();
+				printf("%-10s %s\n", test.name, passed ? "ok" : "FAILED");
+				if (!passed) {
+					failed = true;
+				}
+			}
+		}
+	} else {
+		auto all = benchmarks();
+		for (auto & benchmark : all) {
+			if (argc < 3 || strcmp(argv[2], benchmark.name) == 0) {
+				if (!runBenchmark(benchmark)) {
+					failed = true;
+				}
+			}
+		}
+	}
+
+	for (uint8_t channel = 0; channel < AUDIO_CHANNELS; channel++) {
+		audioTaskKill(channel);
+	}
+	return failed ? 1 : 0;
+}
+
+// Stand-ins for the rest of video.ino
+//
+void debug_log(const char *format, ...) {
+	#if DEBUG == 1
+	va_list ap;
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+	#endif
+}
+
+void setConsoleMode(bool mode) {
+	consoleMode = mode;
+}
+
+void switchTerminalMode() {
+	terminalMode = true;
+}
+
+void print(char const * text) {
+	for (size_t i = 0; i < strlen(text); i++) {
+		processor->vdu(text[i]);
+	}
+}
+
+void printFmt(const char *format, ...) {
+	va_list ap;
+	va_start(ap, format);
+	int size = vsnprintf(nullptr, 0, format, ap) + 1;
+	if (size > 0) {
+		va_end(ap);
+		va_start(ap, format);
+		char buf[size + 1];
+		vsnprintf(buf, size, format, ap);
+		print(buf);
+	}
+	va_end(ap);
+}
+
+bool zdi_mode() {
+	return false;
+}
+
+void zdi_enter() {}
+
+void zdi_process_cmd(uint8_t key) {}
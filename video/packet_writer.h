@@ -0,0 +1,137 @@
+#ifndef PACKET_WRITER_H
+#define PACKET_WRITER_H
+
+#include <cstring>
+#include <Stream.h>
+
+#include "agon.h"
+
+#define PACKET_TYPES			128		// Packet codes are 7 bits, as the top bit marks the start of a packet
+
+// Per packet type statistics
+//
+struct PacketStats {
+	uint32_t	packets;			// Number of packets sent
+	uint32_t	bytes;				// Bytes sent, including the code and length bytes
+	uint32_t	flushes;			// Number of flushes that included at least one of these packets
+};
+
+// Outbound packet writer
+// Packets for the eZ80 are assembled in a staging buffer, and handed to the
+// serial port in a single write when the buffer is flushed or fills up
+// All output for the eZ80 goes through the one writer, so nothing is reordered
+// Packets for any other stream (such as a buffer set up with BUFFERED_SET_OUTPUT)
+// are written straight through, one write per packet
+//
+class PacketWriter {
+	public:
+		void begin(Stream * stream) {
+			flush();
+			target = stream;
+		}
+		void send(Stream * stream, uint8_t code, uint16_t len, uint8_t data[]);
+		void write(Stream * stream, uint8_t b);
+		void flush();
+
+		void getStats(uint8_t code, PacketStats * packetStats);
+		void getTotals(PacketStats * packetStats);
+		void resetStats();
+
+	private:
+		void reserve(uint16_t len);
+
+		Stream *	target = nullptr;					// The stream packets are staged for
+		uint8_t		buffer[PACKET_BUFFER_SIZE];
+		uint16_t	length = 0;							// Bytes staged
+		uint8_t		pendingTypes[PACKET_TYPES];		// Packet codes in the staging buffer
+		uint8_t		pendingTypeCount = 0;
+		PacketStats	stats[PACKET_TYPES] = {};
+		uint32_t	flushCount = 0;
+};
+
+// Send a packet of data to the given stream
+//
+void PacketWriter::send(Stream * stream, uint8_t code, uint16_t len, uint8_t data[]) {
+	len &= 0xFF;
+	code &= PACKET_TYPES - 1;
+	auto & packetStats = stats[code];
+	packetStats.packets++;
+	packetStats.bytes += len + 2;
+
+	if (stream != target) {
+		uint8_t packet[257];
+		packet[0] = code + 0x80;
+		packet[1] = len;
+		memcpy(&packet[2], data, len);
+		stream->write(packet, len + 2);
+		return;
+	}
+
+	reserve(len + 2);
+	buffer[length++] = code + 0x80;
+	buffer[length++] = len;
+	memcpy(&buffer[length], data, len);
+	length += len;
+
+	for (auto i = 0; i < pendingTypeCount; i++) {
+		if (pendingTypes[i] == code) {
+			return;
+		}
+	}
+	pendingTypes[pendingTypeCount++] = code;
+}
+
+// Send a single raw byte to the given stream
+//
+void PacketWriter::write(Stream * stream, uint8_t b) {
+	if (stream != target) {
+		stream->write(b);
+		return;
+	}
+	reserve(1);
+	buffer[length++] = b;
+}
+
+// Hand anything staged to the serial port
+//
+void PacketWriter::flush() {
+	if (length == 0) {
+		return;
+	}
+	target->write(buffer, length);
+	length = 0;
+	flushCount++;
+	for (auto i = 0; i < pendingTypeCount; i++) {
+		stats[pendingTypes[i]].flushes++;
+	}
+	pendingTypeCount = 0;
+}
+
+// Make room for len more bytes in the staging buffer, flushing it if needed
+// The buffer is sized so that any packet fits into it once it is empty
+//
+void PacketWriter::reserve(uint16_t len) {
+	if (length + len > sizeof buffer) {
+		flush();
+	}
+}
+
+void PacketWriter::getStats(uint8_t code, PacketStats * packetStats) {
+	*packetStats = stats[code & (PACKET_TYPES - 1)];
+}
+
+void PacketWriter::getTotals(PacketStats * packetStats) {
+	*packetStats = {};
+	for (auto i = 0; i < PACKET_TYPES; i++) {
+		packetStats->packets += stats[i].packets;
+		packetStats->bytes += stats[i].bytes;
+	}
+	packetStats->flushes = flushCount;
+}
+
+void PacketWriter::resetStats() {
+	memset(stats, 0, sizeof stats);
+	flushCount = 0;
+}
+
+#endif // PACKET_WRITER_H
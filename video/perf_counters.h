@@ -0,0 +1,70 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstring>
+#include <Arduino.h>
+
+#include "agon.h"
+
+#define PERF_VDU_CODES			33		// VDU 0 to 31, with every printable character sharing the last entry
+#define PERF_SYS_CODES			256		// VDU 23, 0, n
+
+// Counters for a single command
+//
+struct PerfCounter {
+	uint32_t	invocations;		// Number of times the command ran
+	uint32_t	argBytes;			// Bytes read while it ran, after its header
+	uint32_t	micros;				// Cumulative time spent in it, including any commands it ran
+	uint32_t	timeouts;			// Reads that timed out while it ran
+};
+
+PerfCounter		perfVDU[PERF_VDU_CODES] = {};	// Counters for each VDU code
+PerfCounter		perfSys[PERF_SYS_CODES] = {};	// Counters for each VDU 23, 0 command
+
+inline PerfCounter & perfVDUCounter(uint8_t c) {
+	return perfVDU[c < PERF_VDU_CODES - 1 ? c : PERF_VDU_CODES - 1];
+}
+
+void resetPerfCounters() {
+	memset(perfVDU, 0, sizeof perfVDU);
+	memset(perfSys, 0, sizeof perfSys);
+}
+
+#if VDP_PERF_COUNTERS == 1
+
+uint32_t		perfBytesRead = 0;				// Running count of bytes read by every stream processor
+uint32_t		perfTimeouts = 0;				// Running count of read timeouts
+
+// Counts a command for as long as it's in scope
+// Only a few loads and stores, plus two calls to micros, so it can be left enabled
+//
+class PerfScope {
+	public:
+		PerfScope(PerfCounter & counter) : counter(counter), start(micros()), bytesRead(perfBytesRead), timeouts(perfTimeouts) {}
+		~PerfScope() {
+			counter.invocations++;
+			counter.argBytes += perfBytesRead - bytesRead;
+			counter.micros += micros() - start;
+			counter.timeouts += perfTimeouts - timeouts;
+		}
+
+	private:
+		PerfCounter &	counter;
+		uint32_t		start;
+		uint32_t		bytesRead;
+		uint32_t		timeouts;
+};
+
+#define PERF_SCOPE(counter)		PerfScope perfScope(counter)
+#define PERF_COUNT_READ(n)		perfBytesRead += (n)
+#define PERF_COUNT_TIMEOUT()	perfTimeouts++
+
+#else
+
+#define PERF_SCOPE(counter)
+#define PERF_COUNT_READ(n)
+#define PERF_COUNT_TIMEOUT()
+
+#endif // VDP_PERF_COUNTERS
+
+#endif // PERF_COUNTERS_H
@@ -0,0 +1,183 @@
+#ifndef RX_RING_STREAM_H
+#define RX_RING_STREAM_H
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <HardwareSerial.h>
+#include <Stream.h>
+
+#include "agon.h"
+#include "types.h"
+
+// Receive ring statistics
+//
+struct RxRingStats {
+	uint32_t	size;				// Ring capacity in bytes
+	uint32_t	level;				// Bytes currently waiting in the ring
+	uint32_t	peakLevel;			// Highest fill level seen
+	uint32_t	received;			// Total bytes received (wraps)
+	uint32_t	throttled;			// Number of times the ring reached its high watermark
+};
+
+// A large receive ring for the VDP serial port
+// The ring is filled from the UART by a dedicated task (see vdp_protocol.h)
+// and read by the stream processor via the Stream interface
+// Writes are passed straight through to the serial port
+//
+// There is a single producer (receive) and a single consumer (everything else),
+// so the ring positions are free-running counters that are only ever advanced
+// by their owning side
+//
+class RxRingStream : public Stream {
+	public:
+		RxRingStream(HardwareSerial * serial) : serial(serial) {}
+		bool begin(uint32_t size);
+		int available();
+		int read();
+		int peek();
+		size_t readBytes(uint8_t * data, size_t length);
+		size_t readBytes(char * data, size_t length) {
+			return readBytes((uint8_t *)data, length);
+		}
+		size_t write(uint8_t b);
+		size_t write(const uint8_t * data, size_t length);
+		void flush();
+
+		uint32_t receive();
+		void getStats(RxRingStats * stats);
+		void resetStats();
+
+	private:
+		HardwareSerial * serial;
+		std::unique_ptr<uint8_t[]> buffer;
+		uint32_t size = 0;
+		uint32_t mask = 0;
+		std::atomic<uint32_t> head { 0 };		// Write position, advanced by receive()
+		std::atomic<uint32_t> tail { 0 };		// Read position, advanced by the reader
+		bool throttled = false;					// Stopped draining the UART until the ring empties to the low watermark
+		// Statistics are updated by receive() and read or reset from the other core
+		std::atomic<uint32_t> peakLevel { 0 };
+		std::atomic<uint32_t> received { 0 };
+		std::atomic<uint32_t> throttleCount { 0 };
+};
+
+// Allocate the ring
+// Size must be a power of 2
+//
+bool RxRingStream::begin(uint32_t ringSize) {
+	buffer = make_unique_psram_array<uint8_t>(ringSize);
+	if (!buffer) {
+		debug_log("RxRingStream: failed to allocate %d byte ring\n\r", ringSize);
+		return false;
+	}
+	size = ringSize;
+	mask = ringSize - 1;
+	return true;
+}
+
+int RxRingStream::available() {
+	return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+}
+
+int RxRingStream::read() {
+	auto t = tail.load(std::memory_order_relaxed);
+	if (head.load(std::memory_order_acquire) == t) {
+		return -1;
+	}
+	uint8_t b = buffer[t & mask];
+	tail.store(t + 1, std::memory_order_release);
+	return b;
+}
+
+int RxRingStream::peek() {
+	auto t = tail.load(std::memory_order_relaxed);
+	if (head.load(std::memory_order_acquire) == t) {
+		return -1;
+	}
+	return buffer[t & mask];
+}
+
+// Bulk read from the ring, returning the number of bytes copied
+//
+size_t RxRingStream::readBytes(uint8_t * data, size_t length) {
+	auto t = tail.load(std::memory_order_relaxed);
+	uint32_t level = head.load(std::memory_order_acquire) - t;
+	if (length > level) {
+		length = level;
+	}
+	// copy in up to two parts, as the data may wrap around the end of the ring
+	auto start = t & mask;
+	size_t first = std::min<size_t>(length, size - start);
+	memcpy(data, buffer.get() + start, first);
+	memcpy(data + first, buffer.get(), length - first);
+	tail.store(t + length, std::memory_order_release);
+	return length;
+}
+
+size_t RxRingStream::write(uint8_t b) {
+	return serial->write(b);
+}
+
+size_t RxRingStream::write(const uint8_t * data, size_t length) {
+	return serial->write(data, length);
+}
+
+void RxRingStream::flush() {
+	serial->flush();
+}
+
+// Move any waiting bytes from the UART driver into the ring
+// Called from the receive task only
+// Once the ring reaches its high watermark we stop draining the UART, so the
+// UART's own buffer fills and hardware flow control raises RTS to hold off the eZ80
+// Returns the number of bytes moved
+//
+uint32_t RxRingStream::receive() {
+	auto h = head.load(std::memory_order_relaxed);
+	uint32_t level = h - tail.load(std::memory_order_acquire);
+
+	if (throttled) {
+		if (level > UART_RX_RING_LOW) {
+			return 0;
+		}
+		throttled = false;
+	}
+	if (level >= UART_RX_RING_HIGH) {
+		throttled = true;
+		throttleCount.fetch_add(1, std::memory_order_relaxed);
+		return 0;
+	}
+
+	uint32_t waiting = serial->available();
+	if (waiting == 0) {
+		return 0;
+	}
+	// read up to the end of the ring in one go; any remainder is picked up next time
+	auto start = h & mask;
+	uint32_t length = std::min(waiting, std::min(size - level, size - start));
+	length = serial->read(buffer.get() + start, length);
+	head.store(h + length, std::memory_order_release);
+
+	received.fetch_add(length, std::memory_order_relaxed);
+	// raise the peak without losing a concurrent reset
+	auto peak = peakLevel.load(std::memory_order_relaxed);
+	while (level + length > peak && !peakLevel.compare_exchange_weak(peak, level + length, std::memory_order_relaxed)) {}
+	return length;
+}
+
+void RxRingStream::getStats(RxRingStats * stats) {
+	stats->size = size;
+	stats->level = available();
+	stats->peakLevel = peakLevel.load(std::memory_order_relaxed);
+	stats->received = received.load(std::memory_order_relaxed);
+	stats->throttled = throttleCount.load(std::memory_order_relaxed);
+}
+
+void RxRingStream::resetStats() {
+	peakLevel.store(available(), std::memory_order_relaxed);
+	received.store(0, std::memory_order_relaxed);
+	throttleCount.store(0, std::memory_order_relaxed);
+}
+
+#endif // RX_RING_STREAM_H
@@ -12,9 +12,11 @@
 #include "agon.h"
 #include "agon_ps2.h"
 #include "agon_screen.h"
+#include "buffers.h"
+#include "id_table.h"
 
 uint16_t		currentBitmap = BUFFERED_BITMAP_BASEID;	// Current bitmap ID
-std::unordered_map<uint16_t, std::shared_ptr<Bitmap>> bitmaps;	// Storage for our bitmaps
+IdTable<std::shared_ptr<Bitmap>> bitmaps;		// Storage for our bitmaps
 uint8_t			numsprites = 0;					// Number of sprites on stage
 uint8_t			current_sprite = 0;				// Current sprite number
 Sprite			sprites[MAX_SPRITES];			// Sprite object storage
@@ -26,8 +28,9 @@ std::unordered_map<uint16_t, fabgl::Cursor> cursors;	// Storage for our cursors
 uint16_t		mCursor = MOUSE_DEFAULT_CURSOR;	// Mouse cursor
 
 std::shared_ptr<Bitmap> getBitmap(uint16_t id = currentBitmap) {
-	if (bitmaps.find(id) != bitmaps.end()) {
-		return bitmaps[id];
+	auto bitmap = bitmaps.find(id);
+	if (bitmap != bitmaps.end()) {
+		return bitmap->second;
 	}
 	return nullptr;
 }
@@ -43,6 +46,7 @@ inline uint16_t getCurrentBitmapId() {
 void drawBitmap(uint16_t x, uint16_t y) {
 	auto bitmap = getBitmap();
 	if (bitmap) {
+		touchBuffer(currentBitmap);
 		canvas->drawBitmap(x, y, bitmap.get());
 	} else {
 		debug_log("drawBitmap: bitmap %d not found\n\r", currentBitmap);
@@ -138,11 +142,17 @@ void clearSpriteFrames(uint8_t s = current_sprite) {
 	}
 }
 
+// Check whether a bitmap is used by a sprite or mouse cursor, which keep pointers to its data
+//
+bool bitmapInUse(uint16_t b) {
+	auto users = bitmapUsers.find(b);
+	return (users != bitmapUsers.end() && !users->second.empty()) || cursors.find(b) != cursors.end();
+}
+
 void clearBitmap(uint16_t b = currentBitmap) {
-	if (bitmaps.find(b) == bitmaps.end()) {
+	if (bitmaps.erase(b) == 0) {
 		return;
 	}
-	bitmaps.erase(b);
 	// find all sprites that had used this bitmap and clear their frames
 	if (bitmapUsers.find(b) != bitmapUsers.end()) {
 		auto users = bitmapUsers[b];
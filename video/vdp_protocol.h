@@ -13,31 +13,108 @@
 #include <HardwareSerial.h>
 
 #include "agon.h"								// Configuration file
+#include "packet_writer.h"
+#include "rx_ring_stream.h"
 
 #define VDPSerial Serial2
 
+RxRingStream	VDPRxStream(&VDPSerial);		// Receive ring, filled from VDPSerial
+TaskHandle_t	VDPRxTask = nullptr;			// Task filling the receive ring
+volatile bool	VDPRxPause = false;				// Ask the receive task to leave the UART alone
+volatile bool	VDPRxPaused = false;			// The receive task has stopped reading the UART
+uint32_t		VDPBaudRate = UART_BR;			// Current baud rate
+PacketWriter	VDPPacketWriter;				// Outbound packet staging
+
+// Receive task
+// Drains the UART into the receive ring, sleeping for a tick whenever there's nothing to move
+//
+void vdp_receive_task(void * parameters) {
+	auto ring = (RxRingStream *)parameters;
+
+	while (true) {
+		if (VDPRxPause) {
+			VDPRxPaused = true;
+			vTaskDelay(1);
+			continue;
+		}
+		VDPRxPaused = false;
+		if (ring->receive() == 0) {
+			vTaskDelay(1);
+		}
+	}
+}
+
+// Get the stream that VDP commands should be read from
+// This is the receive ring, unless it couldn't be allocated
+//
+Stream * getVDPStream() {
+	if (VDPRxTask) {
+		return &VDPRxStream;
+	}
+	return &VDPSerial;
+}
+
 void setupVDPProtocol() {
 	VDPSerial.end();
 	VDPSerial.setRxBufferSize(UART_RX_SIZE);					// Can't be called when running
-	VDPSerial.begin(UART_BR, SERIAL_8N1, UART_RX, UART_TX);
+	VDPSerial.begin(VDPBaudRate, SERIAL_8N1, UART_RX, UART_TX);
 	VDPSerial.setHwFlowCtrlMode(HW_FLOWCTRL_RTS, 64);			// Can be called whenever
 	VDPSerial.setPins(UART_NA, UART_NA, UART_CTS, UART_RTS);	// Must be called after begin
+
+	if (VDPRxStream.begin(UART_RX_RING_SIZE)) {
+		xTaskCreatePinnedToCore(vdp_receive_task, "vdp_receive",
+			4096,						// This stack size can be checked & adjusted by reading the Stack Highwater
+			&VDPRxStream,				// Parameters
+			UART_RX_TASK_PRIORITY,		// Priority
+			&VDPRxTask,					// Task handle
+			UART_RX_TASK_CORE
+		);
+	}
+	VDPPacketWriter.begin(getVDPStream());
+}
+
+// Keep the receive task off the UART
+// Returns once the task has acknowledged, so the caller can use VDPSerial directly
+// The acknowledgement is cleared first, as one left over from an earlier pause doesn't mean
+// the task has seen this one
+//
+void pauseVDPReceive() {
+	if (VDPRxTask) {
+		VDPRxPaused = false;
+		VDPRxPause = true;
+		while (!VDPRxPaused) {
+			vTaskDelay(1);
+		}
+	}
+}
+
+void resumeVDPReceive() {
+	VDPRxPause = false;
+}
+
+// Switch the UART to a new baud rate
+// Anything already written is sent at the old rate first, and the receive task
+// is kept off the UART while its speed changes
+//
+void setVDPBaudRate(uint32_t baudRate) {
+	VDPPacketWriter.flush();
+	VDPSerial.flush();
+	pauseVDPReceive();
+	VDPSerial.updateBaudRate(baudRate);
+	VDPBaudRate = baudRate;
+	resumeVDPReceive();
 }
 
 // TODO remove the following - it's only here for cursor.h to send escape key when doing paged mode handling
 
 inline void writeByte(uint8_t b) {
-	VDPSerial.write(b);
+	VDPPacketWriter.write(getVDPStream(), b);
 }
 
 // Send a packet of data to the MOS
 //
 void send_packet(uint8_t code, uint16_t len, uint8_t data[]) {
-	writeByte(code + 0x80);
-	writeByte(len);
-	for (int i = 0; i < len; i++) {
-		writeByte(data[i]);
-	}
+	VDPPacketWriter.send(getVDPStream(), code, len, data);
 }
 
 #endif // AGON_VDP_PROTOCOL_H
@@ -10,6 +10,7 @@
 // Handle VDU commands
 //
 void VDUStreamProcessor::vdu(uint8_t c) {
+	PERF_SCOPE(perfVDUCounter(c));
 
 	// We want to send raw chars back to the debugger
 	// this allows binary (faster) data transfer in ZDI mode
@@ -119,8 +120,10 @@ void VDUStreamProcessor::vdu_colour() {
 // VDU 18 Handle GCOL
 // 
 void VDUStreamProcessor::vdu_gcol() {
-	auto mode = readByte_t();
-	auto colour = readByte_t();
+	uint8_t args[2];
+	if (!readArgs_t(args, sizeof args)) return;
+	auto mode = args[0];
+	auto colour = args[1];
 
 	setGraphicsColour(mode, colour);
 }
@@ -128,11 +131,13 @@ void VDUStreamProcessor::vdu_gcol() {
 // VDU 19 Handle palette
 //
 void VDUStreamProcessor::vdu_palette() {
-	auto l = readByte_t(); if (l == -1) return; // Logical colour
-	auto p = readByte_t(); if (p == -1) return; // Physical colour
-	auto r = readByte_t(); if (r == -1) return; // The red component
-	auto g = readByte_t(); if (g == -1) return; // The green component
-	auto b = readByte_t(); if (b == -1) return; // The blue component
+	uint8_t args[5];
+	if (!readArgs_t(args, sizeof args)) return;
+	auto l = args[0];	// Logical colour
+	auto p = args[1];	// Physical colour
+	auto r = args[2];	// The red component
+	auto g = args[3];	// The green component
+	auto b = args[4];	// The blue component
 
 	setPalette(l, p, r, g, b);
 }
@@ -155,10 +160,12 @@ void VDUStreamProcessor::vdu_mode() {
 // Example: VDU 24,640;256;1152;896;
 //
 void VDUStreamProcessor::vdu_graphicsViewport() {
-	auto x1 = readWord_t();			// Left
-	auto y2 = readWord_t();			// Bottom
-	auto x2 = readWord_t();			// Right
-	auto y1 = readWord_t();			// Top
+	uint8_t args[8];
+	if (!readArgs_t(args, sizeof args)) return;
+	auto x1 = argWord(&args[0]);	// Left
+	auto y2 = argWord(&args[2]);	// Bottom
+	auto x2 = argWord(&args[4]);	// Right
+	auto y1 = argWord(&args[6]);	// Top
 
 	if (setGraphicsViewport(x1, y1, x2, y2)) {
 		debug_log("vdu_graphicsViewport: OK %d,%d,%d,%d\n\r", x1, y1, x2, y2);
@@ -170,12 +177,14 @@ void VDUStreamProcessor::vdu_graphicsViewport() {
 // VDU 25 Handle PLOT
 //
 void VDUStreamProcessor::vdu_plot() {
-	auto command = readByte_t(); if (command == -1) return;
+	uint8_t args[5];
+	if (!readArgs_t(args, sizeof args)) return;
+	auto command = args[0];
 	auto mode = command & 0x07;
 	auto operation = command & 0xF8;
 
-	auto x = readWord_t(); if (x == -1) return; else x = (short)x;
-	auto y = readWord_t(); if (y == -1) return; else y = (short)y;
+	auto x = (short)argWord(&args[1]);
+	auto y = (short)argWord(&args[3]);
 	if (ttxtMode) return;
 
 	if (mode < 4) {
@@ -296,10 +305,12 @@ void VDUStreamProcessor::vdu_resetViewports() {
 // Example: VDU 28,20,23,34,4
 //
 void VDUStreamProcessor::vdu_textViewport() {
-	auto cx1 = readByte_t();
-	auto cy2 = readByte_t();
-	auto cx2 = readByte_t();
-	auto cy1 = readByte_t();
+	uint8_t args[4];
+	if (!readArgs_t(args, sizeof args)) return;
+	auto cx1 = args[0];
+	auto cy2 = args[1];
+	auto cx2 = args[2];
+	auto cy1 = args[3];
 	auto x1 = cx1 * fontW;				// Left
 	auto y2 = (cy2 + 1) * fontH - 1;	// Bottom
 	auto x2 = (cx2 + 1) * fontW - 1;	// Right
@@ -322,26 +333,22 @@ void VDUStreamProcessor::vdu_textViewport() {
 // Handle VDU 29
 //
 void VDUStreamProcessor::vdu_origin() {
-	auto x = readWord_t();
-	if (x >= 0) {
-		auto y = readWord_t();
-		if (y >= 0) {
-			setOrigin(x, y);
-			debug_log("vdu_origin: %d,%d\n\r", x, y);
-		}
-	}
+	uint8_t args[4];
+	if (!readArgs_t(args, sizeof args)) return;
+	auto x = argWord(&args[0]);
+	auto y = argWord(&args[2]);
+
+	setOrigin(x, y);
+	debug_log("vdu_origin: %d,%d\n\r", x, y);
 }
 
 // VDU 30 TAB(x,y)
 //
 void VDUStreamProcessor::vdu_cursorTab() {
-	auto x = readByte_t();
-	if (x >= 0) {
-		auto y = readByte_t();
-		if (y >= 0) {
-			cursorTab(x, y);
-		}
-	}
+	uint8_t args[2];
+	if (!readArgs_t(args, sizeof args)) return;
+
+	cursorTab(args[0], args[1]);
 }
 
 #endif // VDU_H
@@ -25,9 +25,11 @@ void VDUStreamProcessor::vdu_sys_audio() {
 
 	switch (command) {
 		case AUDIO_CMD_PLAY: {
-			auto volume = readByte_t();		if (volume == -1) return;
-			auto frequency = readWord_t();	if (frequency == -1) return;
-			auto duration = readWord_t();	if (duration == -1) return;
+			uint8_t args[5];
+			if (!readArgs_t(args, sizeof args)) return;
+			auto volume = args[0];
+			auto frequency = argWord(&args[1]);
+			auto duration = argWord(&args[3]);
 
 			sendAudioStatus(channel, play_note(channel, volume, frequency, duration));
 		}	break;
@@ -171,12 +173,14 @@ uint8_t VDUStreamProcessor::loadSample(uint16_t bufferId, uint32_t length) {
 // Create a sample from a buffer
 //
 uint8_t VDUStreamProcessor::createSampleFromBuffer(uint16_t bufferId, uint8_t format) {
-	if (buffers.find(bufferId) == buffers.end()) {
+	auto buffer = buffers.find(bufferId);
+	if (buffer == buffers.end()) {
 		debug_log("vdu_sys_audio: buffer %d not found\n\r", bufferId);
 		return 0;
 	}
+	buffer->second.touch();
 	clearSample(bufferId);
-	auto sample = make_shared_psram<audio_sample>(buffers[bufferId], format);
+	auto sample = make_shared_psram<audio_sample>(buffer->second, format);
 	// auto sample = make_shared_psram<audio_sample>(bufferId, format);
 	if (sample) {
 		samples[bufferId] = sample;
@@ -5,25 +5,91 @@
 #include <memory>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "agon.h"
 #include "buffers.h"
+#include "buffer_adjust.h"
+#include "buffer_registers.h"
 #include "buffer_stream.h"
+#include "decoded_buffer.h"
+#include "lz4.h"
 #include "multi_buffer_stream.h"
 #include "sprites.h"
 #include "types.h"
 
+// A nested buffer call's stream processor and input streams
+// Frames are created the first time a call reaches their depth, and reused from then on,
+// so calling a buffer doesn't need to allocate anything
+//
+struct CallFrame {
+	CallFrame() : processor(nullptr, nullptr, 65535) {}
+
+	VDUStreamProcessor	processor;
+	DecodedBufferStream	decodedStream;
+	MultiBufferStream	multiBufferStream;
+	BufferArguments		arguments;					// Bytes replaced by the call's arguments
+	int32_t				argumentsBufferId = -1;		// Buffer the arguments are for, or -1 if the call has none
+	int32_t				runningBufferId = -1;		// Buffer being run, which changes if the call jumps
+};
+
+std::unique_ptr<CallFrame>	callFrames[BUFFER_CALL_MAX_DEPTH];
+uint8_t						callDepth = 0;		// Number of frames in use
+
+// Check whether a call is part-way through running a buffer
+// The buffer clock can't tell, as it moves on with each command the call runs
+//
+bool bufferRunning(uint16_t bufferId) {
+	for (uint8_t depth = 0; depth < callDepth; depth++) {
+		if (callFrames[depth]->runningBufferId == bufferId) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// A condition read from the stream, kept so that it can be checked more than once
+//
+struct BufferCondition {
+	uint8_t		op;
+	uint8_t		width;				// Size of the values compared, in bytes
+	uint16_t	checkBufferId;
+	uint32_t	offset;
+	bool		useBufferValue;		// Operand is fetched from a buffer, rather than given
+	uint16_t	operandBufferId;
+	uint32_t	operandOffset;
+	int64_t		operandValue;		// Given operand, or -1 if it couldn't be read
+};
+
+// Get a stream owned by a call frame as a shared_ptr, without taking ownership of it
+//
+template<typename T>
+inline std::shared_ptr<T> frameStream(T * stream) {
+	return std::shared_ptr<T>(std::shared_ptr<T>(), stream);
+}
+
 // VDU 23, 0, &A0, bufferId; command: Buffered command support
 //
 void VDUStreamProcessor::vdu_sys_buffered() {
 	auto bufferId = readWord_t();
 	auto command = readByte_t();
 
+	bufferClock++;
 	switch (command) {
 		case BUFFERED_WRITE: {
 			auto length = readWord_t(); if (length == -1) return;
 			bufferWrite(bufferId, length);
 		}	break;
+		case BUFFERED_WRITE_COMPRESSED: {
+			auto compressedLength = readWord_t(); if (compressedLength == -1) return;
+			auto length = readWord_t(); if (length == -1) return;
+			bufferWriteCompressed(bufferId, compressedLength, length);
+		}	break;
+		case BUFFERED_WRITE_LARGE: {
+			uint8_t args[6];
+			if (!readArgs_t(args, sizeof args)) return;
+			bufferWriteLarge(bufferId, arg24(&args[0]), arg24(&args[3]));
+		}	break;
 		case BUFFERED_CALL: {
 			bufferCall(bufferId, 0);
 		}	break;
@@ -157,13 +223,33 @@ void VDUStreamProcessor::vdu_sys_buffered() {
 			auto options = readByte_t(); if (options == -1) return;
 			bufferReverse(bufferId, options);
 		}	break;
+		case BUFFERED_SHARING_STATS: {
+			sendBufferSharingStats(bufferId);
+		}	break;
+		case BUFFERED_MEMORY_STATS: {
+			auto count = readByte_t(); if (count == -1) return;
+			sendBufferMemoryStats(bufferId, count);
+		}	break;
+		case BUFFERED_SET_CACHEABLE: {
+			auto cacheable = readByte_t(); if (cacheable == -1) return;
+			bufferSetCacheable(bufferId, cacheable);
+		}	break;
+		case BUFFERED_SET_QUOTA: {
+			uint8_t args[3];
+			if (!readArgs_t(args, sizeof args)) return;
+			bufferSetQuota(arg24(args));
+		}	break;
+		case BUFFERED_POOL_STATS: {
+			sendBufferPoolStats();
+		}	break;
 		case BUFFERED_DEBUG_INFO: {
-			debug_log("vdu_sys_buffered: buffer %d, %d streams stored\n\r", bufferId, buffers[bufferId].size());
-			if (buffers[bufferId].size() == 0) {
+			auto & blocks = buffers[bufferId];
+			debug_log("vdu_sys_buffered: buffer %d, %d streams stored\n\r", bufferId, blocks.size());
+			if (blocks.size() == 0) {
 				return;
 			}
 			// output contents of buffer stream 0
-			auto buffer = buffers[bufferId][0];
+			auto buffer = blocks[0];
 			auto bufferLength = buffer->size();
 			for (auto i = 0; i < bufferLength; i++) {
 				auto data = buffer->getBuffer()[i];
@@ -171,10 +257,72 @@ void VDUStreamProcessor::vdu_sys_buffered() {
 			}
 			debug_log("\n\r");
 		}	break;
+		case BUFFERED_INTERLEAVE: {
+			auto width = readWord_t(); if (width == -1) return;
+			auto sourceBufferIds = getBufferIdsFromStream();
+			if (sourceBufferIds.size() == 0) {
+				debug_log("vdu_sys_buffered: no source buffer IDs\n\r");
+				return;
+			}
+			bufferInterleave(bufferId, width, sourceBufferIds);
+		}	break;
+		case BUFFERED_INTERLEAVE_FROM: {
+			auto width = readWord_t(); if (width == -1) return;
+			auto count = readWord_t(); if (count == -1) return;
+			auto sourceStart = readWord_t(); if (sourceStart == -1 || sourceStart == 65535) return;
+			std::vector<uint16_t> sourceBufferIds;
+			for (auto sourceId = sourceStart; sourceId < sourceStart + count && sourceId < 65535; sourceId++) {
+				sourceBufferIds.push_back(sourceId);
+			}
+			bufferInterleave(bufferId, width, sourceBufferIds);
+		}	break;
+		case BUFFERED_LOOP: {
+			auto count = readWord_t(); if (count == -1) return;
+			bufferLoop(bufferId, count, nullptr);
+		}	break;
+		case BUFFERED_LOOP_WHILE: {
+			BufferCondition condition;
+			if (readCondition(condition)) {
+				bufferLoop(bufferId, 0, &condition);
+			}
+		}	break;
+		case BUFFERED_SET_PARAMETERS: {
+			bufferSetParameters(bufferId);
+		}	break;
+		case BUFFERED_CALL_ARGS: {
+			auto count = readByte_t(); if (count == -1) return;
+			if (count > BUFFER_CALL_MAX_ARGS) {
+				debug_log("vdu_sys_buffered: too many arguments, %d\n\r", count);
+				discardBytes(count * 2);
+				return;
+			}
+			uint16_t arguments[BUFFER_CALL_MAX_ARGS];
+			for (auto i = 0; i < count; i++) {
+				auto argument = readWord_t(); if (argument == -1) return;
+				arguments[i] = argument;
+			}
+			bufferCallWithArguments(bufferId, arguments, count);
+		}	break;
+		case BUFFERED_REGISTER: {
+			bufferRegister(bufferId);
+		}	break;
+		case BUFFERED_REG_COND_CALL: {
+			// VDU 23, 0, &A0, bufferId; &26, <register conditional arguments> : Conditional call on a register
+			if (registerConditional()) {
+				bufferCall(bufferId, 0);
+			}
+		}	break;
+		case BUFFERED_REG_COND_JUMP: {
+			// VDU 23, 0, &A0, bufferId; &27, <register conditional arguments> : Conditional jump on a register
+			if (registerConditional()) {
+				bufferJump(bufferId, bufferId == 65535 ? -1 : 0);
+			}
+		}	break;
 		default: {
 			debug_log("vdu_sys_buffered: unknown command %d, buffer %d\n\r", command, bufferId);
 		}	break;
 	}
+	sendEvictedBuffers();
 }
 
 // VDU 23, 0, &A0, bufferId; 0, length; data...: store stream into buffer
@@ -182,10 +330,17 @@ void VDUStreamProcessor::vdu_sys_buffered() {
 // allowing a single bufferId to store multiple streams of data
 //
 uint32_t VDUStreamProcessor::bufferWrite(uint16_t bufferId, uint32_t length) {
-	auto bufferStream = make_shared_psram<BufferStream>(length);
+	touchBuffer(bufferId);
+	auto bufferStream = make_shared_pooled<BufferStream>(length);
 
 	debug_log("bufferWrite: storing stream into buffer %d, length %d\n\r", bufferId, length);
 
+	if (!bufferStream || (length > 0 && !bufferStream->getBuffer())) {
+		debug_log("bufferWrite: failed to allocate %d bytes for buffer %d\n\r", length, bufferId);
+		discardBytes(length);
+		return length;
+	}
+
 	auto remaining = readIntoBuffer(bufferStream->getBuffer(), length);
 	if (remaining > 0) {
 		// NB this discards the data we just read
@@ -199,11 +354,134 @@ uint32_t VDUStreamProcessor::bufferWrite(uint16_t bufferId, uint32_t length) {
 		return remaining;
 	}
 
-	buffers[bufferId].push_back(std::move(bufferStream));
-	debug_log("bufferWrite: stored stream in buffer %d, length %d, %d streams stored\n\r", bufferId, length, buffers[bufferId].size());
+	auto & blocks = buffers[bufferId];
+	blocks.push_back(std::move(bufferStream));
+	invalidateDecodedBuffer(bufferId);
+	debug_log("bufferWrite: stored stream in buffer %d, length %d, %d streams stored\n\r", bufferId, length, blocks.size());
 	return remaining;
 }
 
+// VDU 23, 0, &A0, bufferId; &19, compressedLength; length; data...: store LZ4 compressed stream into buffer
+// The data is decompressed as it is stored, adding a new stream of the given
+// (uncompressed) length to the buffer; the stream is dropped if it doesn't decompress cleanly
+//
+uint32_t VDUStreamProcessor::bufferWriteCompressed(uint16_t bufferId, uint32_t compressedLength, uint32_t length) {
+	touchBuffer(bufferId);
+	// the compressed data is only kept until it's decompressed, so it's staged outside the buffer quota
+	auto compressedStream = makeStagingStream(compressedLength);
+
+	debug_log("bufferWriteCompressed: storing stream into buffer %d, length %d (%d compressed)\n\r", bufferId, length, compressedLength);
+
+	if (compressedLength > 0 && !compressedStream->getBuffer()) {
+		debug_log("bufferWriteCompressed: failed to allocate %d bytes for buffer %d\n\r", compressedLength, bufferId);
+		discardBytes(compressedLength);
+		return compressedLength;
+	}
+
+	auto remaining = readIntoBuffer(compressedStream->getBuffer(), compressedLength);
+	if (remaining > 0) {
+		debug_log("bufferWriteCompressed: timed out write for buffer %d (%d bytes remaining)\n\r", bufferId, remaining);
+		return remaining;
+	}
+
+	if (bufferId == 65535) {
+		// buffer ID of -1 (65535) reserved so we don't store it
+		debug_log("bufferWriteCompressed: ignoring buffer 65535\n\r");
+		return remaining;
+	}
+
+	auto bufferStream = lz4DecompressStream(*compressedStream, length);
+	if (!bufferStream) {
+		debug_log("bufferWriteCompressed: failed to decompress stream for buffer %d\n\r", bufferId);
+		return remaining;
+	}
+	auto & blocks = buffers[bufferId];
+	blocks.push_back(std::move(bufferStream));
+	invalidateDecodedBuffer(bufferId);
+	debug_log("bufferWriteCompressed: stored stream in buffer %d, length %d, %d streams stored\n\r", bufferId, length, blocks.size());
+	return remaining;
+}
+
+// VDU 23, 0, &A0, bufferId; &1A, length; lengthHighByte, offset; offsetHighByte, data...: store large stream into buffer
+// Receives up to 16MB into a single block, which is allocated when offset is 0
+// Gaps in the data are fine, but if none arrives for BUFFER_WRITE_STALL_TIMEOUT the partly
+// filled block is kept, so the host can send the rest starting from the reported offset
+// A status packet reports how much of the block has been received once the command finishes
+// Returns the number of bytes not received
+//
+uint32_t VDUStreamProcessor::bufferWriteLarge(uint16_t bufferId, uint32_t length, uint32_t offset) {
+	debug_log("bufferWriteLarge: buffer %d, length %d, from offset %d\n\r", bufferId, length, offset);
+
+	touchBuffer(bufferId);
+	auto pending = pendingWrites.find(bufferId);
+	if (offset == 0 && bufferId != 65535) {
+		if (pending != pendingWrites.end()) {
+			pendingWrites.erase(pending);
+		}
+		auto bufferStream = make_shared_pooled<BufferStream>(length);
+		if (bufferStream && (bufferStream->getBuffer() || length == 0)) {
+			pending = pendingWrites.insert({ bufferId, { bufferStream, 0 } }).first;
+		}
+	}
+	if (pending == pendingWrites.end() || pending->second.stream->size() != length || offset > pending->second.received) {
+		// couldn't allocate, or there's nothing to resume from this offset
+		debug_log("bufferWriteLarge: can't write buffer %d from offset %d\n\r", bufferId, offset);
+		discardBytes(length - std::min(offset, length));
+		sendBufferWriteStatus(bufferId, BUFFER_WRITE_FAILED, 0, length);
+		return length;
+	}
+
+	auto & write = pending->second;
+	auto data = write.stream->getBuffer();
+	auto position = offset;
+	auto t = millis();
+
+	while (position < length) {
+		auto available = inputStream->available();
+		if (available > 0) {
+			auto chunk = std::min<uint32_t>(available, length - position);
+			inputStream->readBytes(data + position, chunk);
+			PERF_COUNT_READ(chunk);
+			position += chunk;
+			t = millis();
+		} else if (millis() - t > BUFFER_WRITE_STALL_TIMEOUT) {
+			debug_log("bufferWriteLarge: stalled at offset %d of %d for buffer %d\n\r", position, length, bufferId);
+			countTimeout();
+			break;
+		} else {
+			VDPPacketWriter.flush();
+		}
+	}
+	write.received = position;
+
+	if (position < length) {
+		sendBufferWriteStatus(bufferId, BUFFER_WRITE_PARTIAL, position, length);
+		return length - position;
+	}
+	auto & blocks = buffers[bufferId];
+	blocks.push_back(std::move(write.stream));
+	pendingWrites.erase(pending);
+	invalidateDecodedBuffer(bufferId);
+	debug_log("bufferWriteLarge: stored stream in buffer %d, length %d, %d streams stored\n\r", bufferId, length, blocks.size());
+	sendBufferWriteStatus(bufferId, BUFFER_WRITE_COMPLETE, position, length);
+	return 0;
+}
+
+void VDUStreamProcessor::sendBufferWriteStatus(uint16_t bufferId, uint8_t status, uint32_t offset, uint32_t length) {
+	uint8_t packet[] = {
+		(uint8_t)(bufferId & 0xFF),
+		(uint8_t)((bufferId >> 8) & 0xFF),
+		status,
+		(uint8_t)(offset & 0xFF),
+		(uint8_t)((offset >> 8) & 0xFF),
+		(uint8_t)((offset >> 16) & 0xFF),
+		(uint8_t)(length & 0xFF),
+		(uint8_t)((length >> 8) & 0xFF),
+		(uint8_t)((length >> 16) & 0xFF),
+	};
+	send_packet(PACKET_BUFFERWRITE, sizeof packet, packet);
+}
+
 // VDU 23, 0, &A0, bufferId; 1: Call buffer
 // VDU 23, 0, &A0, bufferId; &0B, offset; offsetHighByte  : Offset call
 // Processes all commands from the streams stored against the given bufferId
@@ -224,19 +502,273 @@ void VDUStreamProcessor::bufferCall(uint16_t callBufferId, uint32_t offset) {
 		bufferJump(bufferId, offset);
 		return;
 	}
-	auto streams = buffers[bufferId];
-	auto multiBufferStream = make_shared_psram<MultiBufferStream>(streams);
-	if (offset) {
-		multiBufferStream->seekTo(offset);
+	auto frame = enterCallFrame(bufferId);
+	if (!frame) {
+		return;
+	}
+	runCallFrame(frame, bufferId, offset);
+	leaveCallFrame(frame);
+}
+
+// VDU 23, 0, &A0, bufferId; &23, count; : Call buffer count times
+// VDU 23, 0, &A0, bufferId; &24, <conditional arguments> : Call buffer for as long as the condition holds
+// The condition is checked before each call, so the buffer may not be called at all
+// All of the calls run in the same call frame, so a loop only uses one level of nesting however
+// many times it goes round, which makes it a cheaper way to repeat something than a buffer that
+// calls or jumps back to itself
+//
+void VDUStreamProcessor::bufferLoop(uint16_t callBufferId, uint16_t count, BufferCondition * condition) {
+	auto bufferId = resolveBufferId(callBufferId, id);
+	if (bufferId == -1) {
+		debug_log("bufferLoop: no buffer ID\n\r");
+		return;
+	}
+	CallFrame * frame = nullptr;
+	uint32_t iterations = 0;
+	while (condition ? checkCondition(*condition) : iterations < count) {
+		// the buffer may have been cleared by the previous time round
+		if (buffers.find(bufferId) == buffers.end()) {
+			debug_log("bufferLoop: buffer %d not found\n\r", bufferId);
+			break;
+		}
+		if (!frame) {
+			frame = enterCallFrame(bufferId);
+			if (!frame) {
+				return;
+			}
+		}
+		runCallFrame(frame, bufferId, 0);
+		iterations++;
 	}
-	auto streamProcessor = make_unique_psram<VDUStreamProcessor>(multiBufferStream, outputStream, bufferId);
-	if (streamProcessor) {
-		streamProcessor->processAllAvailable();
+	if (frame) {
+		leaveCallFrame(frame);
+	}
+	debug_log("bufferLoop: called buffer %d %d times\n\r", bufferId, iterations);
+}
+
+// VDU 23, 0, &A0, bufferId; &28, <offset; index, width>, ...; 65535; : Set buffer parameters
+// Sets where arguments are substituted into a buffer when it's called with them, replacing any set before
+// Each parameter is the offset to substitute at, the index of the argument to use,
+// and the width of the substitution (1 for just the argument's low byte, or 2 for all of it)
+// Parameters are kept when the buffer's contents change in place, so a template can adjust itself,
+// and go when the buffer is cleared or replaced
+//
+void VDUStreamProcessor::bufferSetParameters(uint16_t bufferId) {
+	std::vector<BufferParameter> parameters;
+	while (true) {
+		auto offset = readWord_t(); if (offset == -1) return;
+		if (offset == 65535) {
+			break;
+		}
+		auto index = readByte_t(); if (index == -1) return;
+		auto width = readByte_t(); if (width == -1) return;
+		if (width != 1 && width != 2) {
+			debug_log("bufferSetParameters: ignoring parameter at offset %d, width %d\n\r", offset, width);
+			continue;
+		}
+		parameters.push_back({ (uint16_t)offset, (uint8_t)index, (uint8_t)width });
+	}
+	auto buffer = buffers.find(bufferId);
+	if (buffer == buffers.end()) {
+		debug_log("bufferSetParameters: buffer %d not found\n\r", bufferId);
+		return;
+	}
+	buffer->second.parameters = parameters;
+	debug_log("bufferSetParameters: buffer %d has %d parameters\n\r", bufferId, parameters.size());
+}
+
+// VDU 23, 0, &A0, bufferId; &29, count, <arguments>; : Call buffer with arguments
+// Calls a buffer with up to BUFFER_CALL_MAX_ARGS 16-bit arguments, which are substituted into it
+// where its parameters say as it's read, leaving the buffer itself unchanged
+// This lets one buffer be used as a template, for example to draw a shape somewhere different each call
+// Parameters whose argument isn't given keep the buffer's own bytes
+// Any byte can be substituted, including the bytes that identify a command
+// The arguments last until the call returns, or jumps to a different buffer
+//
+void VDUStreamProcessor::bufferCallWithArguments(uint16_t callBufferId, uint16_t * arguments, uint8_t count) {
+	auto bufferId = resolveBufferId(callBufferId, id);
+	if (bufferId == -1) {
+		debug_log("bufferCallWithArguments: no buffer ID\n\r");
+		return;
+	}
+	auto buffer = buffers.find(bufferId);
+	if (buffer == buffers.end()) {
+		debug_log("bufferCallWithArguments: buffer %d not found\n\r", bufferId);
+		return;
+	}
+	auto & blocks = buffer->second;
+	blocks.touch();
+	// parameters that no longer fit in the buffer, as it's been made shorter, are dropped
+	auto length = blocks.bytes();
+	auto & parameters = blocks.parameters;
+	parameters.erase(std::remove_if(parameters.begin(), parameters.end(),
+		[length](const BufferParameter & parameter) { return parameter.offset + parameter.width > length; }), parameters.end());
+	// unlike a plain call this is never turned into a jump at the end of a buffer, as jumps don't take arguments
+	auto frame = enterCallFrame(bufferId);
+	if (!frame) {
+		return;
+	}
+	frame->arguments.set(parameters, arguments, count);
+	frame->argumentsBufferId = bufferId;
+	runCallFrame(frame, bufferId, 0);
+	leaveCallFrame(frame);
+}
+
+// Get the frame for a call from this one, creating it the first time a call reaches its depth
+// Returns nullptr if calls are nested too deeply, or the frame couldn't be created
+//
+CallFrame * VDUStreamProcessor::enterCallFrame(uint16_t bufferId) {
+	if (callDepth >= BUFFER_CALL_MAX_DEPTH) {
+		debug_log("bufferCall: buffer %d not called, calls nested too deeply\n\r", bufferId);
+		sendCallDepthError(bufferId);
+		return nullptr;
+	}
+	auto & frame = callFrames[callDepth];
+	if (!frame) {
+		frame = make_unique_psram<CallFrame>();
+		if (!frame) {
+			debug_log("bufferCall: failed to create stream processor\n\r");
+			return nullptr;
+		}
+	}
+	return frame.get();
+}
+
+// Run a buffer in a call frame, from the given offset
+//
+void VDUStreamProcessor::runCallFrame(CallFrame * frame, uint16_t bufferId, uint32_t offset) {
+	auto & streamProcessor = frame->processor;
+	streamProcessor = VDUStreamProcessor(nullptr, outputStream, bufferId);
+	streamProcessor.callFrame = frame;
+	streamProcessor.setBufferInput(bufferId, offset);
+
+	callDepth++;
+	streamProcessor.processAllAvailable();
+	callDepth--;
+}
+
+// Finish with a call frame, letting go of everything the call was using so that it can be freed
+//
+void VDUStreamProcessor::leaveCallFrame(CallFrame * frame) {
+	frame->processor = VDUStreamProcessor(nullptr, nullptr, 65535);
+	frame->decodedStream.end();
+	frame->multiBufferStream.end();
+	frame->arguments.clear();
+	frame->argumentsBufferId = -1;
+	frame->runningBufferId = -1;
+}
+
+// Tell the MOS that a buffer wasn't called because calls were nested too deeply
+//
+void VDUStreamProcessor::sendCallDepthError(uint16_t bufferId) {
+	uint8_t packet[] = {
+		(uint8_t)(bufferId & 0xFF),
+		(uint8_t)((bufferId >> 8) & 0xFF),
+		callDepth,
+	};
+	send_packet(PACKET_CALLDEPTH, sizeof packet, packet);
+}
+
+// Set our input to read from a buffer, starting at the given offset
+// Buffers that can be decoded are run from their decoded version
+// When we're running in a call frame the frame's own streams are used, rather than new ones,
+// and the call's arguments are substituted if they're for this buffer
+//
+void VDUStreamProcessor::setBufferInput(uint16_t bufferId, uint32_t offset) {
+	BufferArguments * arguments = nullptr;
+	if (callFrame) {
+		callFrame->runningBufferId = bufferId;
+		if (callFrame->argumentsBufferId == bufferId) {
+			arguments = &callFrame->arguments;
+		}
+	}
+	auto decoded = getDecodedBuffer(bufferId);
+	if (decoded) {
+		std::shared_ptr<DecodedBufferStream> stream;
+		if (callFrame) {
+			callFrame->decodedStream.begin(decoded, arguments);
+			stream = frameStream(&callFrame->decodedStream);
+		} else {
+			stream = make_shared_psram<DecodedBufferStream>(decoded);
+		}
+		stream->seekTo(offset);
+		setDecodedInput(stream);
+		touchBuffer(bufferId);
+		return;
+	}
+	auto & blocks = buffers[bufferId];
+	blocks.touch();
+	setBlockInput(blocks, offset, arguments);
+}
+
+// Set our input to read from a list of blocks, starting at the given offset
+// Arguments can only be substituted when we're running in a call frame
+//
+void VDUStreamProcessor::setBlockInput(const std::vector<std::shared_ptr<BufferStream>> & blocks, uint32_t offset, BufferArguments * arguments) {
+	std::shared_ptr<MultiBufferStream> stream;
+	if (callFrame) {
+		callFrame->multiBufferStream.begin(blocks, arguments);
+		stream = frameStream(&callFrame->multiBufferStream);
 	} else {
-		debug_log("bufferCall: failed to create stream processor\n\r");
+		stream = make_shared_psram<MultiBufferStream>(blocks);
+	}
+	if (offset) {
+		stream->seekTo(offset);
+	}
+	decodedStream = nullptr;
+	inputStream = stream;
+	if (callFrame) {
+		// blocks may belong to the decoded buffer we were running, so only let go of it now
+		callFrame->decodedStream.end();
 	}
 }
 
+// Remove a buffer, along with any bitmap or sample made from it
+// Returns false if there was no such buffer
+//
+bool dropBuffer(uint16_t bufferId) {
+	pendingWrites.erase(bufferId);
+	invalidateDecodedBuffer(bufferId);
+	if (buffers.find(bufferId) == buffers.end()) {
+		return false;
+	}
+	// samples refer to their buffer's list of blocks, so go before it's emptied
+	clearBitmap(bufferId);
+	clearSample(bufferId);
+	buffers.erase(bufferId);
+	return true;
+}
+
+// Evict the least recently used cacheable buffer, to make room for an allocation
+// Buffers used by the current command are skipped, as it may be part-way through working on them,
+// as are buffers a call is running, buffers whose bitmap is in use by a sprite or mouse cursor,
+// and buffers whose sample a channel is using
+// The host is told which buffers were evicted once the command finishes
+// Returns false if there was nothing that could be evicted
+//
+bool evictCachedBuffer() {
+	auto victim = buffers.end();
+	for (auto buffer = buffers.begin(); buffer != buffers.end(); ++buffer) {
+		auto & blocks = buffer->second;
+		if (!blocks.cacheable || blocks.inUse() || blocks.empty() || bufferRunning(buffer->first)
+			|| bitmapInUse(buffer->first) || sampleInUse(buffer->first)) {
+			continue;
+		}
+		if (victim == buffers.end() || blocks.lastUsed < victim->second.lastUsed) {
+			victim = buffer;
+		}
+	}
+	if (victim == buffers.end()) {
+		return false;
+	}
+	uint16_t bufferId = victim->first;
+	debug_log("evictCachedBuffer: evicting buffer %d, %d bytes\n\r", bufferId, victim->second.bytes());
+	dropBuffer(bufferId);
+	evictedBuffers.push_back(bufferId);
+	bufferEvictions++;
+	return true;
+}
+
 // VDU 23, 0, &A0, bufferId; 2: Clear buffer
 // Removes all streams stored against the given bufferId
 // sending a bufferId of 65535 (i.e. -1) clears all buffers
@@ -245,17 +777,16 @@ void VDUStreamProcessor::bufferClear(uint16_t bufferId) {
 	debug_log("bufferClear: buffer %d\n\r", bufferId);
 	if (bufferId == 65535) {
 		buffers.clear();
+		pendingWrites.clear();
+		invalidateDecodedBuffer(65535);
 		resetBitmaps();
 		resetSamples();
 		return;
 	}
-	if (buffers.find(bufferId) == buffers.end()) {
+	if (!dropBuffer(bufferId)) {
 		debug_log("bufferClear: buffer %d not found\n\r", bufferId);
 		return;
 	}
-	buffers.erase(bufferId);
-	clearBitmap(bufferId);
-	clearSample(bufferId);
 	debug_log("bufferClear: cleared buffer %d\n\r", bufferId);
 }
 
@@ -271,8 +802,8 @@ std::shared_ptr<WritableBufferStream> VDUStreamProcessor::bufferCreate(uint16_t
 		debug_log("bufferCreate: buffer %d already exists\n\r", bufferId);
 		return nullptr;
 	}
-	auto buffer = make_shared_psram<WritableBufferStream>(size);
-	if (!buffer) {
+	auto buffer = make_shared_pooled<WritableBufferStream>(size);
+	if (!buffer || (size > 0 && !buffer->getBuffer())) {
 		debug_log("bufferCreate: failed to create buffer %d\n\r", bufferId);
 		return nullptr;
 	}
@@ -281,6 +812,7 @@ std::shared_ptr<WritableBufferStream> VDUStreamProcessor::bufferCreate(uint16_t
 		buffer->writeBufferByte(0, i);
 	}
 	buffers[bufferId].push_back(buffer);
+	invalidateDecodedBuffer(bufferId);
 	debug_log("bufferCreate: created buffer %d, size %d\n\r", bufferId, size);
 	return buffer;
 }
@@ -301,11 +833,12 @@ void VDUStreamProcessor::setOutputStream(uint16_t bufferId) {
 		outputStream = originalOutputStream;
 		return;
 	}
-	if (buffers.find(bufferId) == buffers.end()) {
+	auto buffer = buffers.find(bufferId);
+	if (buffer == buffers.end()) {
 		debug_log("setOutputStream: buffer %d not found\n\r", bufferId);
 		return;
 	}
-	auto output = buffers[bufferId][0];
+	auto output = buffer->second[0];
 	if (output->isWritable()) {
 		outputStream = output;
 	} else {
@@ -326,21 +859,18 @@ uint32_t VDUStreamProcessor::getOffsetFromStream(uint16_t bufferId, bool isAdvan
 			if (blockOffset == -1) {
 				return -1;
 			}
-			if (buffers.find(bufferId) == buffers.end()) {
+			auto buffer = buffers.find(bufferId);
+			if (buffer == buffers.end()) {
 				debug_log("getOffsetFromStream: buffer %d not found\n\r", bufferId);
 				return -1;
 			}
-			if (blockOffset >= buffers[bufferId].size()) {
-				debug_log("getOffsetFromStream: block offset %d is greater than number of blocks %d\n\r", blockOffset, buffers[bufferId].size());
+			auto & blocks = buffer->second;
+			if ((size_t)blockOffset >= blocks.size()) {
+				debug_log("getOffsetFromStream: block offset %d is greater than number of blocks %d\n\r", blockOffset, blocks.size());
 				return -1;
 			}
-			// calculate our true offset
-			// by counting up sizes of all blocks before the one we want
-			auto trueOffset = offset & 0x007FFFFF;
-			for (auto i = 0; i < blockOffset; i++) {
-				trueOffset += buffers[bufferId][i]->size();
-			}
-			return trueOffset;
+			// calculate our true offset from where the block we want starts
+			return (offset & 0x007FFFFF) + blocks.blockStart(blockOffset);
 		}
 		return offset;
 	}
@@ -370,15 +900,14 @@ std::vector<uint16_t> VDUStreamProcessor::getBufferIdsFromStream() {
 
 // Utility call to read a byte from a buffer at the given offset
 int16_t VDUStreamProcessor::getBufferByte(uint16_t bufferId, uint32_t offset) {
-	if (buffers.find(bufferId) != buffers.end()) {
-		// loop thru blocks stored against this ID to find data at offset
-		auto currentOffset = offset;
-		for (auto block : buffers[bufferId]) {
-			auto bufferLength = block->size();
-			if (currentOffset < bufferLength) {
-				return block->getBuffer()[currentOffset];
-			}
-			currentOffset -= bufferLength;
+	auto buffer = buffers.find(bufferId);
+	if (buffer != buffers.end()) {
+		buffer->second.touch();
+		// find the block containing the offset
+		size_t index;
+		uint32_t blockOffset;
+		if (buffer->second.find(offset, index, blockOffset)) {
+			return buffer->second[index]->getBuffer()[blockOffset];
 		}
 	}
 	// buffer doesn't exist, or offset not found
@@ -386,27 +915,51 @@ int16_t VDUStreamProcessor::getBufferByte(uint16_t bufferId, uint32_t offset) {
 }
 
 // Utility call to set a byte in a buffer at the given offset
+// Returns false if the buffer doesn't exist, the offset is past its end, or it couldn't be changed
 bool VDUStreamProcessor::setBufferByte(uint8_t value, uint16_t bufferId, uint32_t offset) {
-	if (buffers.find(bufferId) != buffers.end()) {
+	auto buffer = buffers.find(bufferId);
+	if (buffer != buffers.end()) {
+		buffer->second.touch();
 		// find the block containing the offset
-		auto currentOffset = offset;
-		for (auto block : buffers[bufferId]) {
-			auto bufferLength = block->size();
-			if (currentOffset < bufferLength) {
-				block->writeBufferByte(value, currentOffset);
-				return true;
-			}
-			currentOffset -= bufferLength;
+		size_t index;
+		uint32_t blockOffset;
+		if (buffer->second.find(offset, index, blockOffset)) {
+			return buffer->second[index]->writeBufferByte(value, blockOffset);
 		}
 	}
 	// buffer didn't exist, or offset not found
 	return false;
 }
 
+// Utility call to read a little-endian value of 1 to 4 bytes from a buffer at the given offset
+// Returns -1 if the buffer doesn't exist, or the value runs past its end
+int64_t VDUStreamProcessor::getBufferValue(uint16_t bufferId, uint32_t offset, uint8_t width) {
+	int64_t value = 0;
+	for (auto i = 0; i < width; i++) {
+		auto byte = getBufferByte(bufferId, offset + i);
+		if (byte == -1) {
+			return -1;
+		}
+		value |= (int64_t)byte << (i * 8);
+	}
+	return value;
+}
+
+// Utility call to write a little-endian value of 1 to 4 bytes to a buffer at the given offset
+bool VDUStreamProcessor::setBufferValue(uint32_t value, uint16_t bufferId, uint32_t offset, uint8_t width) {
+	for (auto i = 0; i < width; i++) {
+		if (!setBufferByte(value >> (i * 8), bufferId, offset + i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
 // VDU 23, 0, &A0, bufferId; 5, operation, offset; [count;] [operand]: Adjust buffer
 // This is used for adjusting the contents of a buffer
 // It can be used to overwrite bytes, insert bytes, increment bytes, etc
 // Basic operation are not, neg, set, add, add-with-carry, and, or, xor
+// along with add and subtract of 16 and 32-bit little-endian values
 // Upper bits of operation byte are used to indicate:
 // - whether to use a long offset (24-bit) or short offset (16-bit)
 // - whether the operand is a buffer-originated value or an immediate value
@@ -418,6 +971,9 @@ void VDUStreamProcessor::bufferAdjust(uint16_t adjustBufferId) {
 
 	auto bufferId = resolveBufferId(adjustBufferId, id);
 	// at this point bufferId could be -1, but that's OK - we will fail later
+	if (bufferId != -1) {
+		invalidateDecodedBuffer(bufferId);
+	}
 	bool useAdvancedOffsets = command & ADJUST_ADVANCED_OFFSETS;
 	bool useBufferValue = command & ADJUST_BUFFER_VALUE;
 	bool useMultiTarget = command & ADJUST_MULTI_TARGET;
@@ -443,6 +999,10 @@ void VDUStreamProcessor::bufferAdjust(uint16_t adjustBufferId) {
 		debug_log("bufferAdjust: invalid command, count, offset or operand value\n\r");
 		return;
 	}
+	if (op >= ADJUST_ADD_16 && op <= ADJUST_SUB_32) {
+		bufferAdjustValues(op, bufferId, offset, count, useMultiTarget, useMultiOperand, useBufferValue, operandBufferId, operandOffset);
+		return;
+	}
 
 	auto sourceValue = 0;
 	auto operandValue = 0;
@@ -469,61 +1029,78 @@ void VDUStreamProcessor::bufferAdjust(uint16_t adjustBufferId) {
 	debug_log("bufferAdjust: command %d, offset %d, count %d, operandBufferId %d, operandOffset %d, sourceValue %d, operandValue %d\n\r", command, offset, count, operandBufferId, operandOffset, sourceValue, operandValue);
 	debug_log("useMultiTarget %d, useMultiOperand %d, useAdvancedOffsets %d, useBufferValue %d\n\r", useMultiTarget, useMultiOperand, useAdvancedOffsets, useBufferValue);
 
-	for (auto i = 0; i < count; i++) {
-		if (useMultiTarget) {
-			// multiple source values will change
-			sourceValue = getBufferByte(bufferId, offset + i);
-		}
-		if (hasOperand && useMultiOperand) {
-			operandValue = useBufferValue ? getBufferByte(operandBufferId, operandOffset + i) : readByte_t();
+	// multiple targets are adjusted a span at a time, unless the operands come from
+	// earlier in the same run of bytes, in which case they must be done in order
+	bool overlapping = useMultiOperand && useBufferValue && operandBufferId == bufferId
+		&& (uint32_t)operandOffset < offset && (uint32_t)(operandOffset + count) > offset;
+	if (useMultiTarget && !overlapping) {
+		if (operandValue == -1) {
+			debug_log("bufferAdjust: invalid operand value\n\r");
+			return;
 		}
-		if (sourceValue == -1 || operandValue == -1) {
-			debug_log("bufferAdjust: invalid source or operand value\n\r");
+		auto carry = bufferAdjustSpans(op, bufferId, offset, count, hasOperand && useMultiOperand, useBufferValue, operandBufferId, operandOffset, operandValue);
+		if (carry == -1) {
 			return;
 		}
+		carryValue = carry;
+		usingCarry = op == ADJUST_ADD_CARRY;
+	} else {
+		for (auto i = 0; i < count; i++) {
+			if (useMultiTarget) {
+				// multiple source values will change
+				sourceValue = getBufferByte(bufferId, offset + i);
+			}
+			if (hasOperand && useMultiOperand) {
+				operandValue = useBufferValue ? getBufferByte(operandBufferId, operandOffset + i) : readByte_t();
+			}
+			if (sourceValue == -1 || operandValue == -1) {
+				debug_log("bufferAdjust: invalid source or operand value\n\r");
+				return;
+			}
 
-		switch (op) {
-			case ADJUST_NOT: {
-				sourceValue = ~sourceValue;
-			}	break;
-			case ADJUST_NEG: {
-				sourceValue = -sourceValue;
-			}	break;
-			case ADJUST_SET: {
-				sourceValue = operandValue;
-			}	break;
-			case ADJUST_ADD: {
-				// byte-wise add - no carry, so bytes may overflow
-				sourceValue = sourceValue + operandValue;
-			}	break;
-			case ADJUST_ADD_CARRY: {
-				// byte-wise add with carry
-				// bytes are treated as being in little-endian order
-				usingCarry = true;
-				sourceValue = sourceValue + operandValue + carryValue;
-				if (sourceValue > 255) {
-					carryValue = 1;
-					sourceValue -= 256;
-				} else {
-					carryValue = 0;
-				}
-			}	break;
-			case ADJUST_AND: {
-				sourceValue = sourceValue & operandValue;
-			}	break;
-			case ADJUST_OR: {
-				sourceValue = sourceValue | operandValue;
-			}	break;
-			case ADJUST_XOR: {
-				sourceValue = sourceValue ^ operandValue;
-			}	break;
-		}
+			switch (op) {
+				case ADJUST_NOT: {
+					sourceValue = ~sourceValue;
+				}	break;
+				case ADJUST_NEG: {
+					sourceValue = -sourceValue;
+				}	break;
+				case ADJUST_SET: {
+					sourceValue = operandValue;
+				}	break;
+				case ADJUST_ADD: {
+					// byte-wise add - no carry, so bytes may overflow
+					sourceValue = sourceValue + operandValue;
+				}	break;
+				case ADJUST_ADD_CARRY: {
+					// byte-wise add with carry
+					// bytes are treated as being in little-endian order
+					usingCarry = true;
+					sourceValue = sourceValue + operandValue + carryValue;
+					if (sourceValue > 255) {
+						carryValue = 1;
+						sourceValue -= 256;
+					} else {
+						carryValue = 0;
+					}
+				}	break;
+				case ADJUST_AND: {
+					sourceValue = sourceValue & operandValue;
+				}	break;
+				case ADJUST_OR: {
+					sourceValue = sourceValue | operandValue;
+				}	break;
+				case ADJUST_XOR: {
+					sourceValue = sourceValue ^ operandValue;
+				}	break;
+			}
 
-		if (useMultiTarget) {
-			// multiple source/target values updating, so store inside loop
-			if (!setBufferByte(sourceValue, bufferId, offset + i)) {
-				debug_log("bufferAdjust: failed to set result %d at offset %d\n\r", sourceValue, offset + i);
-				return;
+			if (useMultiTarget) {
+				// multiple source/target values updating, so store inside loop
+				if (!setBufferByte(sourceValue, bufferId, offset + i)) {
+					debug_log("bufferAdjust: failed to set result %d at offset %d\n\r", sourceValue, offset + i);
+					return;
+				}
 			}
 		}
 	}
@@ -545,20 +1122,153 @@ void VDUStreamProcessor::bufferAdjust(uint16_t adjustBufferId) {
 	debug_log("bufferAdjust: result %d\n\r", sourceValue);
 }
 
+// Adjust a run of bytes in a buffer, working on a span within one block at a time
+// Operands are a single value, or a run of bytes from the stream or from another buffer
+// Returns:
+// - the final carry value, or -1 if the run couldn't be completed
+//
+int16_t VDUStreamProcessor::bufferAdjustSpans(uint8_t op, uint16_t bufferId, uint32_t offset, uint32_t count, bool useMultiOperand, bool useBufferValue, uint16_t operandBufferId, uint32_t operandOffset, uint8_t operandValue) {
+	auto buffer = buffers.find(bufferId);
+	if (buffer == buffers.end()) {
+		debug_log("bufferAdjust: buffer %d not found\n\r", bufferId);
+		return -1;
+	}
+	auto & blocks = buffer->second;
+	blocks.touch();
+	BufferBlocks * operandBlocks = nullptr;
+	if (useMultiOperand && useBufferValue) {
+		auto operandBuffer = buffers.find(operandBufferId);
+		if (operandBuffer == buffers.end()) {
+			debug_log("bufferAdjust: operand buffer %d not found\n\r", operandBufferId);
+			return -1;
+		}
+		operandBlocks = &operandBuffer->second;
+		operandBlocks->touch();
+	}
+
+	uint8_t operands[64];			// operands read from the stream, a chunk at a time
+	uint32_t operandsRead = 0;
+	uint32_t operandsUsed = 0;
+	uint8_t carry = 0;
+	uint32_t done = 0;
+
+	while (done < count) {
+		size_t index;
+		uint32_t blockOffset;
+		if (!blocks.find(offset + done, index, blockOffset)) {
+			debug_log("bufferAdjust: failed to set result at offset %d\n\r", offset + done);
+			if (useMultiOperand && !useBufferValue && operandsUsed == operandsRead) {
+				// the operand for this byte is still consumed, as it always has been
+				readByte_t();
+			}
+			return -1;
+		}
+		auto & block = blocks[index];
+		auto target = block->getWritableBuffer();
+		if (!target) {
+			debug_log("bufferAdjust: failed to copy shared block\n\r");
+			return -1;
+		}
+		target += blockOffset;
+		auto length = std::min(count - done, block->size() - blockOffset);
+		const uint8_t * operandSpan = nullptr;
+
+		if (operandBlocks) {
+			if (!operandBlocks->find(operandOffset + done, index, blockOffset)) {
+				debug_log("bufferAdjust: invalid operand value at offset %d\n\r", operandOffset + done);
+				return -1;
+			}
+			auto & operandBlock = (*operandBlocks)[index];
+			operandSpan = operandBlock->getBuffer() + blockOffset;
+			length = std::min(length, operandBlock->size() - blockOffset);
+		} else if (useMultiOperand) {
+			if (operandsUsed == operandsRead) {
+				// only read as many as this span needs, so nothing more is consumed if a later one fails
+				operandsRead = std::min<uint32_t>(sizeof operands, length);
+				operandsUsed = 0;
+				if (readIntoBuffer(operands, operandsRead) != 0) {
+					debug_log("bufferAdjust: timed out reading operands\n\r");
+					return -1;
+				}
+			}
+			operandSpan = operands + operandsUsed;
+			length = std::min(length, operandsRead - operandsUsed);
+			operandsUsed += length;
+		}
+
+		carry = adjustSpan(op, target, operandSpan, operandValue, length, carry);
+		done += length;
+	}
+	return carry;
+}
+
+// Adjust 16 or 32-bit little-endian values in a buffer
+// Works like the byte-wise operations, with each target and operand being a whole value,
+// so offsets step on by the value's width, and immediate operands are sent at full width
+// Results wrap around, with no carry
+//
+void VDUStreamProcessor::bufferAdjustValues(uint8_t op, uint16_t bufferId, uint32_t offset, uint32_t count, bool useMultiTarget, bool useMultiOperand, bool useBufferValue, uint16_t operandBufferId, uint32_t operandOffset) {
+	uint8_t width = (op == ADJUST_ADD_16 || op == ADJUST_SUB_16) ? 2 : 4;
+	bool subtract = op == ADJUST_SUB_16 || op == ADJUST_SUB_32;
+	uint32_t mask = width == 2 ? 0xFFFF : 0xFFFFFFFF;
+	int64_t sourceValue = 0;
+	int64_t operandValue = 0;
+
+	if (!useMultiTarget) {
+		sourceValue = getBufferValue(bufferId, offset, width);
+	}
+	if (!useMultiOperand) {
+		operandValue = useBufferValue ? getBufferValue(operandBufferId, operandOffset, width) : readValue_t(width);
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		auto targetOffset = offset + i * width;
+		if (useMultiTarget) {
+			sourceValue = getBufferValue(bufferId, targetOffset, width);
+		}
+		if (useMultiOperand) {
+			operandValue = useBufferValue ? getBufferValue(operandBufferId, operandOffset + i * width, width) : readValue_t(width);
+		}
+		if (sourceValue == -1 || operandValue == -1) {
+			debug_log("bufferAdjust: invalid source or operand value\n\r");
+			return;
+		}
+		sourceValue = (subtract ? sourceValue - operandValue : sourceValue + operandValue) & mask;
+		if (useMultiTarget && !setBufferValue(sourceValue, bufferId, targetOffset, width)) {
+			debug_log("bufferAdjust: failed to set result at offset %d\n\r", targetOffset);
+			return;
+		}
+	}
+	if (!useMultiTarget && !setBufferValue(sourceValue, bufferId, offset, width)) {
+		debug_log("bufferAdjust: failed to set result at offset %d\n\r", offset);
+	}
+}
+
 // returns true or false depending on whether conditions are met
 // Will read the following arguments from the stream
 // operation, checkBufferId; offset; [operand]
 // This works in a similar manner to bufferAdjust
-// for now, this only supports single-byte comparisons
-// as multi-byte comparisons are a bit more complex
+// Single bytes are compared, unless the 16 or 32-bit flag is set in the operation,
+// in which case little-endian values of that width are compared, and an immediate
+// operand is sent at that width too
 // 
 bool VDUStreamProcessor::bufferConditional() {
+	BufferCondition condition;
+	return readCondition(condition) && checkCondition(condition);
+}
+
+// Read the arguments for a condition from the stream, without checking it
+// Returns false if they couldn't be read
+//
+bool VDUStreamProcessor::readCondition(BufferCondition & condition) {
 	auto command = readByte_t();
 	auto checkBufferId = resolveBufferId(readWord_t(), id);
 
 	bool useAdvancedOffsets = command & COND_ADVANCED_OFFSETS;
 	bool useBufferValue = command & COND_BUFFER_VALUE;
 	uint8_t op = command & COND_OP_MASK;
+	// values are compared as unsigned little-endian numbers, of one byte unless a width is given
+	uint8_t width = (command & COND_32BIT) ? 4 : (command & COND_16BIT) ? 2 : 1;
 	// conditional operators that are greater than NOT_EXISTS require an operand
 	bool hasOperand = op > COND_NOT_EXISTS;
 
@@ -576,59 +1286,126 @@ bool VDUStreamProcessor::bufferConditional() {
 		return false;
 	}
 
-	auto sourceValue = getBufferByte(checkBufferId, offset);
-	int16_t operandValue = 0;
+	condition.op = op;
+	condition.width = width;
+	condition.checkBufferId = checkBufferId;
+	condition.offset = offset;
+	condition.useBufferValue = useBufferValue;
+	condition.operandBufferId = operandBufferId;
+	condition.operandOffset = operandOffset;
+	condition.operandValue = (hasOperand && !useBufferValue) ? readValue_t(width) : 0;
+	return true;
+}
+
+// Check a condition against the current contents of the buffers it refers to
+//
+bool VDUStreamProcessor::checkCondition(BufferCondition & condition) {
+	auto op = condition.op;
+	bool hasOperand = op > COND_NOT_EXISTS;
+	auto sourceValue = getBufferValue(condition.checkBufferId, condition.offset, condition.width);
+	int64_t operandValue = 0;
 	if (hasOperand) {
-		operandValue = useBufferValue ? getBufferByte(operandBufferId, operandOffset) : readByte_t();
+		operandValue = condition.useBufferValue ? getBufferValue(condition.operandBufferId, condition.operandOffset, condition.width) : condition.operandValue;
 	}
 
-	debug_log("bufferConditional: command %d, checkBufferId %d, offset %d, operandBufferId %d, operandOffset %d, sourceValue %d, operandValue %d\n\r", command, checkBufferId, offset, operandBufferId, operandOffset, sourceValue, operandValue);
+	debug_log("bufferConditional: op %d, checkBufferId %d, offset %d, operandBufferId %d, operandOffset %d, sourceValue %d, operandValue %d\n\r", op, condition.checkBufferId, condition.offset, condition.operandBufferId, condition.operandOffset, (int32_t)sourceValue, (int32_t)operandValue);
 
 	if (sourceValue == -1 || operandValue == -1) {
 		debug_log("bufferConditional: invalid source or operand value\n\r");
 		return false;
 	}
 
-	bool shouldCall = false;
-
-	switch (op) {
-		case COND_EXISTS: {
-			shouldCall = sourceValue != 0;
-		}	break;
-		case COND_NOT_EXISTS: {
-			shouldCall = sourceValue == 0;
-		}	break;
-		case COND_EQUAL: {
-			shouldCall = sourceValue == operandValue;
-		}	break;
-		case COND_NOT_EQUAL: {
-			shouldCall = sourceValue != operandValue;
-		}	break;
-		case COND_LESS: {
-			shouldCall = sourceValue < operandValue;
-		}	break;
-		case COND_GREATER: {
-			shouldCall = sourceValue > operandValue;
-		}	break;
-		case COND_LESS_EQUAL: {
-			shouldCall = sourceValue <= operandValue;
-		}	break;
-		case COND_GREATER_EQUAL: {
-			shouldCall = sourceValue >= operandValue;
-		}	break;
-		case COND_AND: {
-			shouldCall = sourceValue && operandValue;
-		}	break;
-		case COND_OR: {
-			shouldCall = sourceValue || operandValue;
-		}	break;
-	}
+	bool shouldCall = compareValues(op, sourceValue, operandValue);
 
 	debug_log("bufferConditional: evaluated as %s\n\r", shouldCall ? "true" : "false");
 
 	return shouldCall;
 }
 
+// VDU 23, 0, &A0, bufferId; &25, operation, register, offset; [offsetHighByte] : Load or store a register
+// VDU 23, 0, &A0, bufferId; &25, operation, register, operand : Register arithmetic
+// Load and store read or write a little-endian value of 1, 2 or 4 bytes, as given by the width flags,
+// at an offset in the buffer (which can be 65535 for the current buffer)
+// Other operations ignore the buffer, and take either the number of another register as their operand,
+// or an immediate value of the same width as for load and store
+//
+void VDUStreamProcessor::bufferRegister(uint16_t bufferId) {
+	auto command = readByte_t();
+	auto reg = readByte_t();
+	if (command == -1 || reg == -1) {
+		debug_log("bufferRegister: invalid command or register\n\r");
+		return;
+	}
+	uint8_t op = command & REG_OP_MASK;
+	auto width = registerWidth(command);
+
+	if (op == REG_LOAD || op == REG_STORE) {
+		auto targetBufferId = resolveBufferId(bufferId, id);
+		auto offset = getOffsetFromStream(targetBufferId, command & REG_ADVANCED_OFFSETS);
+		if (targetBufferId == -1 || offset == (uint32_t)-1 || reg >= BUFFER_REGISTERS) {
+			debug_log("bufferRegister: invalid buffer, offset or register\n\r");
+			return;
+		}
+		if (op == REG_STORE) {
+			if (!setBufferValue(bufferRegisters[reg], targetBufferId, offset, width)) {
+				debug_log("bufferRegister: failed to store register %d at offset %d\n\r", reg, offset);
+			}
+			return;
+		}
+		auto value = getBufferValue(targetBufferId, offset, width);
+		if (value == -1) {
+			debug_log("bufferRegister: failed to load register %d from offset %d\n\r", reg, offset);
+			return;
+		}
+		bufferRegisters[reg] = value;
+		return;
+	}
+
+	auto operand = readRegisterOperand(command);
+	if (operand == -1 || reg >= BUFFER_REGISTERS) {
+		debug_log("bufferRegister: invalid register or operand\n\r");
+		return;
+	}
+	bufferRegisters[reg] = registerOp(op, bufferRegisters[reg], operand);
+}
+
+// Read the operand for a register operation or condition, which is either
+// another register's number, or an immediate value of the width given in the command
+// Returns -1 if it couldn't be read
+//
+int64_t VDUStreamProcessor::readRegisterOperand(uint8_t command) {
+	if (command & REG_REGISTER_VALUE) {
+		auto reg = readByte_t();
+		if (reg == -1 || reg >= BUFFER_REGISTERS) {
+			return -1;
+		}
+		return bufferRegisters[reg];
+	}
+	return readValue_t(registerWidth(command));
+}
+
+// returns true or false depending on how a register compares
+// Will read the following arguments from the stream
+// operation, register, [operand]
+// Operations are the same as for bufferConditional, with the operand given in the same way as
+// for register arithmetic, and values compared as unsigned 32-bit numbers
+//
+bool VDUStreamProcessor::registerConditional() {
+	auto command = readByte_t();
+	auto reg = readByte_t();
+	if (command == -1 || reg == -1) {
+		debug_log("registerConditional: invalid command or register\n\r");
+		return false;
+	}
+	uint8_t op = command & COND_OP_MASK;
+	int64_t operand = op > COND_NOT_EXISTS ? readRegisterOperand(command) : 0;
+	if (operand == -1 || reg >= BUFFER_REGISTERS) {
+		debug_log("registerConditional: invalid register or operand\n\r");
+		return false;
+	}
+	return compareValues(op, bufferRegisters[reg], operand);
+}
+
 // VDU 23, 0, &A0, bufferId; 7: Jump to a buffer
 // VDU 23, 0, &A0, bufferId; 9, offset; offsetHighByte : Jump to (advanced) offset within buffer
 // Change execution to given buffer (from beginning or at an offset)
@@ -642,6 +1419,10 @@ void VDUStreamProcessor::bufferJump(uint16_t bufferId, uint32_t offset) {
 	}
 	if (bufferId == 65535 || bufferId == id) {
 		// a buffer ID of 65535 is used to indicate current buffer, so we seek to offset
+		if (decodedStream) {
+			decodedStream->seekTo(offset);
+			return;
+		}
 		auto instream = (MultiBufferStream *)inputStream.get();
 		instream->seekTo(offset);
 		return;
@@ -650,13 +1431,8 @@ void VDUStreamProcessor::bufferJump(uint16_t bufferId, uint32_t offset) {
 		debug_log("bufferJump: buffer %d not found\n\r", bufferId);
 		return;
 	}
-	auto streams = buffers[bufferId];
 	// replace our input stream with a new one
-	auto multiBufferStream = make_shared_psram<MultiBufferStream>(streams);
-	if (offset) {
-		multiBufferStream->seekTo(offset);
-	}
-	inputStream = multiBufferStream;
+	setBufferInput(bufferId, offset);
 }
 
 // VDU 23, 0, &A0, bufferId; &0D, sourceBufferId; sourceBufferId; ...; 65535; : Copy blocks from buffers
@@ -676,17 +1452,19 @@ void VDUStreamProcessor::bufferCopy(uint16_t bufferId, std::vector<uint16_t> sou
 	std::vector<std::shared_ptr<BufferStream>, psram_allocator<std::shared_ptr<BufferStream>>> streams;
 	// loop thru buffer IDs
 	for (auto sourceId : sourceBufferIds) {
-		if (buffers.find(sourceId) != buffers.end()) {
+		auto source = buffers.find(sourceId);
+		if (source != buffers.end()) {
 			// buffer ID exists
+			source->second.touch();
 			// loop thru blocks stored against this ID
-			for (auto block : buffers[sourceId]) {
+			for (auto & block : source->second) {
 				// push a copy of the block into our vector
-				auto bufferStream = make_shared_psram<BufferStream>(block->size());
-				if (!bufferStream || !bufferStream->getBuffer()) {
+				// which shares the block's data until one of them is changed
+				auto bufferStream = block->share();
+				if (!bufferStream) {
 					debug_log("bufferCopy: failed to create buffer\n\r");
 					return;
 				}
-				bufferStream->writeBuffer(block->getBuffer(), block->size());
 				streams.push_back(bufferStream);
 			}
 		} else {
@@ -694,12 +1472,195 @@ void VDUStreamProcessor::bufferCopy(uint16_t bufferId, std::vector<uint16_t> sou
 		}
 	}
 	// replace buffer with new one
-	buffers[bufferId].clear();
-	for (auto block : streams) {
+	invalidateDecodedBuffer(bufferId);
+	auto & blocks = buffers[bufferId];
+	blocks.clear();
+	blocks.parameters.clear();
+	for (auto & block : streams) {
 		debug_log("bufferCopy: copying stream %d bytes\n\r", block->size());
-		buffers[bufferId].push_back(block);
+		blocks.push_back(block);
+	}
+	debug_log("bufferCopy: copied %d streams into buffer %d (%d)\n\r", streams.size(), bufferId, blocks.size());
+}
+
+// VDU 23, 0, &A0, bufferId; &1B : Report buffer sharing statistics
+// Sends the total size of the blocks in a buffer (or all buffers, for a bufferId of 65535),
+// along with how much of that is held in data used by only that block,
+// and how much is held in data shared between copies of a block, counting each shared block once
+//
+void VDUStreamProcessor::sendBufferSharingStats(uint16_t bufferId) {
+	uint32_t totalBytes = 0;
+	uint32_t uniqueBytes = 0;
+	uint32_t sharedBytes = 0;
+	std::unordered_set<uint8_t *> sharedData;
+
+	for (auto & buffer : buffers) {
+		if (bufferId != 65535 && buffer.first != bufferId) {
+			continue;
+		}
+		for (auto & block : buffer.second) {
+			totalBytes += block->size();
+			if (!block->isShared()) {
+				uniqueBytes += block->size();
+			} else if (sharedData.insert(block->getBuffer()).second) {
+				sharedBytes += block->size();
+			}
+		}
+	}
+
+	uint8_t packet[] = {
+		(uint8_t)(bufferId & 0xFF),
+		(uint8_t)((bufferId >> 8) & 0xFF),
+		(uint8_t)(totalBytes & 0xFF),
+		(uint8_t)((totalBytes >> 8) & 0xFF),
+		(uint8_t)((totalBytes >> 16) & 0xFF),
+		(uint8_t)((totalBytes >> 24) & 0xFF),
+		(uint8_t)(uniqueBytes & 0xFF),
+		(uint8_t)((uniqueBytes >> 8) & 0xFF),
+		(uint8_t)((uniqueBytes >> 16) & 0xFF),
+		(uint8_t)((uniqueBytes >> 24) & 0xFF),
+		(uint8_t)(sharedBytes & 0xFF),
+		(uint8_t)((sharedBytes >> 8) & 0xFF),
+		(uint8_t)((sharedBytes >> 16) & 0xFF),
+		(uint8_t)((sharedBytes >> 24) & 0xFF),
+	};
+	send_packet(PACKET_BUFFERSHARING, sizeof packet, packet);
+}
+
+// VDU 23, 0, &A0, bufferId; &1C, count : Report buffer memory use
+// Sends the bytes of block contents currently allocated, the quota (0 for none),
+// the number of buffers evicted so far and the number of buffers,
+// followed by the ID, size and flags of up to count of the largest buffers
+// (or just the given buffer, for a bufferId other than 65535)
+//
+void VDUStreamProcessor::sendBufferMemoryStats(uint16_t bufferId, uint8_t count) {
+	std::vector<std::pair<uint32_t, uint16_t>> sizes;
+	for (auto & buffer : buffers) {
+		if (bufferId == 65535 || buffer.first == bufferId) {
+			sizes.push_back({ buffer.second.bytes(), buffer.first });
+		}
+	}
+	count = std::min<size_t>({ (size_t)count, sizes.size(), BUFFER_MEMORY_MAX_LIST });
+	// largest first, then lowest ID first
+	std::partial_sort(sizes.begin(), sizes.begin() + count, sizes.end(),
+		[](const std::pair<uint32_t, uint16_t> & a, const std::pair<uint32_t, uint16_t> & b) {
+			return a.first > b.first || (a.first == b.first && a.second < b.second);
+		});
+
+	uint32_t values[] = { bufferDataBytes, bufferDataQuota, bufferEvictions };
+	uint8_t packet[sizeof values + 2 + BUFFER_MEMORY_MAX_LIST * 7];
+	auto length = 0;
+	for (auto value : values) {
+		packet[length++] = value & 0xFF;
+		packet[length++] = (value >> 8) & 0xFF;
+		packet[length++] = (value >> 16) & 0xFF;
+		packet[length++] = (value >> 24) & 0xFF;
+	}
+	packet[length++] = buffers.size() & 0xFF;
+	packet[length++] = (buffers.size() >> 8) & 0xFF;
+	for (auto i = 0; i < count; i++) {
+		auto size = sizes[i].first;
+		auto id = sizes[i].second;
+		uint8_t flags = 0;
+		if (buffers.at(id).cacheable) {
+			flags |= BUFFER_MEMORY_CACHEABLE;
+		}
+		if (bitmaps.find(id) != bitmaps.end()) {
+			flags |= BUFFER_MEMORY_BITMAP;
+		}
+		if (samples.find(id) != samples.end()) {
+			flags |= BUFFER_MEMORY_SAMPLE;
+		}
+		packet[length++] = id & 0xFF;
+		packet[length++] = (id >> 8) & 0xFF;
+		packet[length++] = size & 0xFF;
+		packet[length++] = (size >> 8) & 0xFF;
+		packet[length++] = (size >> 16) & 0xFF;
+		packet[length++] = (size >> 24) & 0xFF;
+		packet[length++] = flags;
+	}
+	send_packet(PACKET_BUFFERMEMORY, length, packet);
+}
+
+// VDU 23, 0, &A0, bufferId; &1D, cacheable : Set whether a buffer is cacheable
+// Cacheable buffers are evicted, least recently used first, when an allocation would otherwise fail
+// The host is sent the IDs of evicted buffers, so should only mark buffers it can send again
+//
+void VDUStreamProcessor::bufferSetCacheable(uint16_t setBufferId, bool cacheable) {
+	auto bufferId = resolveBufferId(setBufferId, id);
+	auto buffer = buffers.find(bufferId);
+	if (buffer == buffers.end()) {
+		debug_log("bufferSetCacheable: buffer %d not found\n\r", bufferId);
+		return;
+	}
+	buffer->second.cacheable = cacheable;
+}
+
+// VDU 23, 0, &A0, 65535; &1E, quota; quotaHighByte : Set buffer memory quota
+// Limits the bytes of block contents that can be allocated, with 0 meaning no limit
+// Cacheable buffers are evicted straight away to get back under a new, lower, quota
+//
+void VDUStreamProcessor::bufferSetQuota(uint32_t quota) {
+	bufferDataQuota = quota;
+	while (quota && bufferDataBytes > quota && evictCachedBuffer());
+}
+
+// VDU 23, 0, &A0, 65535; &1F : Report buffer pool statistics
+// Sends the free PSRAM and its largest free block, the bytes held in pool slabs,
+// the bytes asked for by the items in them, and the bytes of blocks too big for a slab,
+// followed by the item size, slab count and items in use for each size class
+// Slab bytes well above the bytes asked for mean slabs are kept by a few items each,
+// and a largest free block well below the free PSRAM means it has fragmented
+//
+void VDUStreamProcessor::sendBufferPoolStats() {
+	uint32_t values[] = {
+		(uint32_t)heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+		(uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM),
+		bufferPool.slabBytes(),
+		bufferPool.requestedBytes(),
+		bufferPool.largeBytes(),
+	};
+	uint8_t packet[sizeof values + BUFFER_POOL_CLASSES * 8];
+	auto length = 0;
+	for (auto value : values) {
+		packet[length++] = value & 0xFF;
+		packet[length++] = (value >> 8) & 0xFF;
+		packet[length++] = (value >> 16) & 0xFF;
+		packet[length++] = (value >> 24) & 0xFF;
+	}
+	for (uint8_t sizeClass = 0; sizeClass < BUFFER_POOL_CLASSES; sizeClass++) {
+		auto size = BufferPool::classSize(sizeClass);
+		auto slabs = bufferPool.slabs(sizeClass);
+		auto items = bufferPool.itemsUsed(sizeClass);
+		packet[length++] = size & 0xFF;
+		packet[length++] = (size >> 8) & 0xFF;
+		packet[length++] = slabs & 0xFF;
+		packet[length++] = (slabs >> 8) & 0xFF;
+		packet[length++] = items & 0xFF;
+		packet[length++] = (items >> 8) & 0xFF;
+		packet[length++] = (items >> 16) & 0xFF;
+		packet[length++] = (items >> 24) & 0xFF;
+	}
+	send_packet(PACKET_BUFFERPOOL, length, packet);
+}
+
+// Tell the host which buffers have been evicted
+// Packets hold the IDs of up to BUFFER_EVICTED_MAX_LIST buffers
+//
+void VDUStreamProcessor::sendEvictedBuffers() {
+	if (evictedBuffers.empty()) {
+		return;
+	}
+	for (size_t start = 0; start < evictedBuffers.size(); start += BUFFER_EVICTED_MAX_LIST) {
+		auto count = std::min<size_t>(evictedBuffers.size() - start, BUFFER_EVICTED_MAX_LIST);
+		uint8_t packet[BUFFER_EVICTED_MAX_LIST * 2];
+		for (size_t i = 0; i < count; i++) {
+			packet[i * 2] = evictedBuffers[start + i] & 0xFF;
+			packet[i * 2 + 1] = (evictedBuffers[start + i] >> 8) & 0xFF;
+		}
+		send_packet(PACKET_BUFFEREVICTED, count * 2, packet);
 	}
-	debug_log("bufferCopy: copied %d streams into buffer %d (%d)\n\r", streams.size(), bufferId, buffers[bufferId].size());
+	evictedBuffers.clear();
 }
 
 // VDU 23, 0, &A0, bufferId; &0E : Consolidate blocks within buffer
@@ -710,30 +1671,33 @@ void VDUStreamProcessor::bufferConsolidate(uint16_t bufferId) {
 	// Create a new stream big enough to contain all streams in the given buffer
 	// Copy all streams into the new stream
 	// Replace the given buffer with the new stream	
-	if (buffers.find(bufferId) == buffers.end()) {
+	auto buffer = buffers.find(bufferId);
+	if (buffer == buffers.end()) {
 		debug_log("bufferConsolidate: buffer %d not found\n\r", bufferId);
 		return;
 	}
-	if (buffers[bufferId].size() == 1) {
+	auto & blocks = buffer->second;
+	blocks.touch();
+	if (blocks.size() == 1) {
 		// only one stream, so nothing to consolidate
 		return;
 	}
 	// buffer ID exists
-	auto bufferStream = consolidateBuffers(buffers[bufferId]);
+	auto bufferStream = consolidateBuffers(blocks);
 	if (!bufferStream) {
 		debug_log("bufferConsolidate: failed to create buffer\n\r");
 		return;
 	}
-	buffers[bufferId].clear();
-	buffers[bufferId].push_back(bufferStream);
-	debug_log("bufferConsolidate: consolidated %d streams into buffer %d\n\r", buffers[bufferId].size(), bufferId);
+	invalidateDecodedBuffer(bufferId);
+	debug_log("bufferConsolidate: consolidated %d streams into buffer %d\n\r", blocks.size(), bufferId);
+	blocks.clear();
+	blocks.push_back(bufferStream);
 }
 
 void clearTargets(std::vector<uint16_t> targets) {
 	for (auto target : targets) {
-		if (buffers.find(target) != buffers.end()) {
-			buffers.erase(target);
-		}
+		buffers.erase(target);
+		invalidateDecodedBuffer(target);
 		clearBitmap(target);
 	}
 }
@@ -745,21 +1709,17 @@ void clearTargets(std::vector<uint16_t> targets) {
 // Will overwrite any existing buffers
 //
 void VDUStreamProcessor::bufferSplitInto(uint16_t bufferId, uint16_t length, std::vector<uint16_t> newBufferIds, bool iterate) {
-	if (buffers.find(bufferId) == buffers.end()) {
+	auto buffer = buffers.find(bufferId);
+	if (buffer == buffers.end()) {
 		debug_log("bufferSplitInto: buffer %d not found\n\r", bufferId);
 		return;
 	}
-	// get a consolidated version of the buffer
-	auto bufferStream = consolidateBuffers(buffers[bufferId]);
-	if (!bufferStream) {
-		debug_log("bufferSplitInto: failed to create buffer\n\r");
-		return;
-	}
+	buffer->second.touch();
+	// split into slices of the buffer's blocks, before any targets (which may include the buffer) are cleared
+	auto chunks = splitBuffer(buffer->second, length);
 	if (!iterate) {
 		clearTargets(newBufferIds);
 	}
-
-	auto chunks = splitBuffer(bufferStream, length);
 	if (chunks.size() == 0) {
 		debug_log("bufferSplitInto: failed to split buffer\n\r");
 		return;
@@ -784,52 +1744,29 @@ void VDUStreamProcessor::bufferSplitInto(uint16_t bufferId, uint16_t length, std
 // Will overwrite any existing buffers
 //
 void VDUStreamProcessor::bufferSplitByInto(uint16_t bufferId, uint16_t width, uint16_t chunkCount, std::vector<uint16_t> newBufferIds, bool iterate) {
-	if (buffers.find(bufferId) == buffers.end()) {
+	auto buffer = buffers.find(bufferId);
+	if (buffer == buffers.end()) {
 		debug_log("bufferSplitByInto: buffer %d not found\n\r", bufferId);
 		return;
 	}
-	// get a consolidated version of the buffer
-	auto bufferStream = consolidateBuffers(buffers[bufferId]);
-	if (!bufferStream) {
-		debug_log("bufferSplitByInto: failed to create buffer\n\r");
-		return;
-	}
+	buffer->second.touch();
+	// gather the chunks for each target, before any targets (which may include the buffer) are cleared
+	auto chunks = deinterleaveBuffer(buffer->second, width, chunkCount);
 	if (!iterate) {
 		clearTargets(newBufferIds);
 	}
-
-	std::vector<std::vector<std::shared_ptr<BufferStream>>> chunks;
-	chunks.resize(chunkCount);
-	{
-		// split to get raw chunks
-		auto rawchunks = splitBuffer(bufferStream, width);
-		if (rawchunks.size() == 0) {
-			debug_log("bufferSplitByInto: failed to split buffer\n\r");
-			return;
-		}
-		// and re-jig into our chunks vector
-		auto chunkIndex = 0;
-		for (auto chunk : rawchunks) {
-			chunks[chunkIndex].push_back(chunk);
-			chunkIndex++;
-			if (chunkIndex >= chunkCount) {
-				chunkIndex = 0;
-			}
-		}
+	if (chunks.size() == 0) {
+		debug_log("bufferSplitByInto: failed to split buffer\n\r");
+		return;
 	}
 
-	// consolidate our chunks, and distribute to buffers
+	// distribute to buffers
 	uint16_t newBufferIndex = 0;
 	auto targetId = newBufferIds[newBufferIndex];
-	for (auto stream : chunks) {
+	for (auto chunk : chunks) {
 		if (iterate) {
 			clearTargets({ targetId });
 		}
-		auto chunk = consolidateBuffers(stream);
-		if (!chunk) {
-			debug_log("bufferSplitByInto: failed to create buffer\n\r");
-			return;
-		}
 		buffers[targetId].push_back(chunk);
 		updateTarget(newBufferIds, targetId, newBufferIndex, iterate);
 	}
@@ -841,11 +1778,14 @@ void VDUStreamProcessor::bufferSplitByInto(uint16_t bufferId, uint16_t width, ui
 // VDU 23, 0, &A0, bufferId; &16, targetBufferId; : Spread blocks from target buffer onwards
 //
 void VDUStreamProcessor::bufferSpreadInto(uint16_t bufferId, std::vector<uint16_t> newBufferIds, bool iterate) {
-	if (buffers.find(bufferId) == buffers.end()) {
+	auto source = buffers.find(bufferId);
+	if (source == buffers.end()) {
 		debug_log("bufferSpreadInto: buffer %d not found\n\r", bufferId);
 		return;
 	}
-	auto buffer = buffers[bufferId];
+	source->second.touch();
+	// take a copy of the block list, as the source may be one of the targets
+	auto buffer = source->second;
 	if (!iterate) {
 		clearTargets(newBufferIds);
 	}
@@ -861,14 +1801,50 @@ void VDUStreamProcessor::bufferSpreadInto(uint16_t bufferId, std::vector<uint16_
 	}
 }
 
+// VDU 23, 0, &A0, bufferId; &21, width; <bufferIds>; 65535; : Interleave buffers by width into a buffer
+// VDU 23, 0, &A0, bufferId; &22, width; count; sourceBufferId; : Interleave buffers from source buffer onwards
+// Takes width bytes from each source buffer in turn, into a single block, until all of them run out
+// The reverse of split by width, so can be used to turn planar data into chunky data,
+// or pack separate channels into a multi-channel sample
+// Will overwrite the target buffer, which may also be one of the sources
+//
+void VDUStreamProcessor::bufferInterleave(uint16_t bufferId, uint16_t width, std::vector<uint16_t> sourceBufferIds) {
+	if (bufferId == 65535 || width == 0) {
+		debug_log("bufferInterleave: ignoring buffer %d, width %d\n\r", bufferId, width);
+		return;
+	}
+	std::vector<BufferBlocks *> sources;
+	for (auto sourceId : sourceBufferIds) {
+		auto source = buffers.find(sourceId);
+		if (source != buffers.end()) {
+			source->second.touch();
+			sources.push_back(&source->second);
+		} else {
+			debug_log("bufferInterleave: buffer %d not found\n\r", sourceId);
+		}
+	}
+	auto block = interleaveBuffers(sources, width);
+	if (!block) {
+		debug_log("bufferInterleave: failed to create buffer\n\r");
+		return;
+	}
+	clearTargets({ bufferId });
+	buffers[bufferId].push_back(block);
+	debug_log("bufferInterleave: interleaved %d buffers into buffer %d, %d bytes\n\r", sources.size(), bufferId, block->size());
+}
+
 // VDU 23, 0, &A0, bufferId; &17 : Reverse blocks within buffer
 // Reverses the order of blocks within a buffer
 // may be useful for mirroring bitmaps if they have been split by row
 //
 void VDUStreamProcessor::bufferReverseBlocks(uint16_t bufferId) {
-	if (buffers.find(bufferId) != buffers.end()) {
+	auto buffer = buffers.find(bufferId);
+	if (buffer != buffers.end()) {
 		// reverse the order of the streams
-		std::reverse(buffers[bufferId].begin(), buffers[bufferId].end());
+		auto & blocks = buffer->second;
+		std::reverse(blocks.begin(), blocks.end());
+		blocks.changed();
+		invalidateDecodedBuffer(bufferId);
 		debug_log("bufferReverseBlocks: reversed blocks in buffer %d\n\r", bufferId);
 	}
 }
@@ -878,10 +1854,13 @@ void VDUStreamProcessor::bufferReverseBlocks(uint16_t bufferId) {
 // may be useful for mirroring bitmaps
 //
 void VDUStreamProcessor::bufferReverse(uint16_t bufferId, uint8_t options) {
-	if (buffers.find(bufferId) == buffers.end()) {
+	auto buffer = buffers.find(bufferId);
+	if (buffer == buffers.end()) {
 		debug_log("bufferReverse: buffer %d not found\n\r", bufferId);
 		return;
 	}
+	auto & blocks = buffer->second;
+	blocks.touch();
 	bool use16Bit = options & REVERSE_16BIT;
 	bool use32Bit = options & REVERSE_32BIT;
 	bool useSize  = (options & REVERSE_SIZE) == REVERSE_SIZE;
@@ -920,7 +1899,7 @@ void VDUStreamProcessor::bufferReverse(uint16_t bufferId, uint8_t options) {
 	}
 
 	// verify that our blocks are a multiple of valueSize
-	for (auto block : buffers[bufferId]) {
+	for (auto & block : blocks) {
 		auto size = block->size();
 		if (size % valueSize != 0 || (chunkSize != 0 && size % chunkSize != 0)) {
 			debug_log("bufferReverse: error - buffer %d contains block not a multiple of value/chunk size %d\n\r", bufferId, valueSize);
@@ -930,15 +1909,20 @@ void VDUStreamProcessor::bufferReverse(uint16_t bufferId, uint8_t options) {
 
 	debug_log("bufferReverse: reversing buffer %d, value size %d, chunk size %d\n\r", bufferId, valueSize, chunkSize);
 
-	for (auto block : buffers[bufferId]) {
+	invalidateDecodedBuffer(bufferId);
+	for (auto & block : blocks) {
+		auto data = block->getWritableBuffer();
+		if (!data) {
+			debug_log("bufferReverse: failed to copy shared block\n\r");
+			return;
+		}
 		if (chunkSize == 0) {
 			// no chunking, so simpler reverse
-			reverseValues(block->getBuffer(), block->size(), valueSize);
+			reverseValues(data, block->size(), valueSize);
 		} else {
 			// reverse in chunks
-			auto data = block->getBuffer();
 			auto chunkCount = block->size() / chunkSize;
-			for (auto i = 0; i < chunkCount; i++) {
+			for (uint32_t i = 0; i < chunkCount; i++) {
 				reverseValues(data + (i * chunkSize), chunkSize, valueSize);
 			}
 		}
@@ -0,0 +1,92 @@
+#ifndef VDU_LENGTHS_H
+#define VDU_LENGTHS_H
+
+#include <cstdint>
+
+#include "agon.h"
+
+#define VDU_VARIABLE_LENGTH		-1		// Argument count can't be known until the command is parsed
+
+// Number of argument bytes that follow each VDU code from 0 to 31
+// VDU 23 is listed as zero, as its length depends on the bytes that follow (see below)
+// Codes 32 and above are characters, and take no arguments
+//
+constexpr int8_t vduArgLengths[32] = {
+	0, 0, 0, 0, 0, 0, 0, 0,		// 0-7
+	0, 0, 0, 0, 0, 0, 0, 0,		// 8-15
+	0, 1, 2, 5, 0, 0, 1, 0,		// 16-23: CLG, COLOUR, GCOL, palette, -, -, MODE, VDU 23
+	8, 5, 0, 0, 4, 4, 0, 2,		// 24-31: graphics viewport, PLOT, reset viewports, -, text viewport, origin, home, TAB
+};
+
+// Number of argument bytes that follow VDU 23, n, for n from 0 to 31
+// VDU 23, 0 is listed as zero, as its length depends on the next byte (see below)
+// Values of n from 32 upwards redefine a character, and are followed by 8 bytes
+//
+constexpr int8_t vduSysArgLengths[32] = {
+	0, 1, 0, 0, 0, 0, 0, 3,		// 0-7: VDP control, cursor control, -, scroll
+	0, 0, 0, 0, 0, 0, 0, 0,		// 8-15
+	2, 0, 0, 0, 0, 0, 0, 0,		// 16-23: cursor behaviour
+	0, 0, 0, VDU_VARIABLE_LENGTH,	// 24-27: sprites and bitmaps
+	VDU_VARIABLE_LENGTH, 0, 0, 0,	// 28-31: hexload
+};
+
+// Number of argument bytes that follow VDU 23, 0, n
+//
+inline int8_t vduSysVideoArgLength(uint8_t mode) {
+	switch (mode) {
+		case VDP_GP:				return 1;
+		case VDP_KEYCODE:			return 1;
+		case VDP_CURSOR:			return 0;
+		case VDP_SCRCHAR:			return 4;
+		case VDP_SCRPIXEL:			return 4;
+		case VDP_MODE:				return 0;
+		case VDP_KEYSTATE:			return 5;
+		case VDP_RXSTATS:			return 1;
+		case VDP_TXSTATS:			return 2;
+		case VDP_PERFSTATS:			return 2;
+		case VDP_PERFRESET:			return 0;
+		case VDP_RESYNC:			return RESYNC_MARKER_LENGTH - 3;
+		case VDP_BAUDRATE:			return 4;
+		case VDP_LOGICALCOORDS:		return 1;
+		case VDP_LEGACYMODES:		return 1;
+		case VDP_SWITCHBUFFER:		return 0;
+		case VDP_CONSOLEMODE:		return 1;
+		case VDP_TERMINALMODE:		return 0;
+		case VDP_AUDIO:
+		case VDP_RTC:
+		case VDP_MOUSE:
+		case VDP_BUFFERED:
+		case VDP_UPDATER:
+		case VDP_FRAME:
+		case VDP_COMPRESSED_FRAME:
+			return VDU_VARIABLE_LENGTH;
+	}
+	return 0;
+}
+
+// Number of header bytes needed to identify a command, given the bytes read so far
+// This is 1 for most commands, 2 for VDU 23, n and 3 for VDU 23, 0, n
+//
+inline uint8_t vduHeaderLength(const uint8_t * header, uint8_t length) {
+	if (length < 1 || header[0] != 0x17) {
+		return 1;
+	}
+	if (length < 2 || header[1] != 0x00) {
+		return 2;
+	}
+	return 3;
+}
+
+// Number of argument bytes that follow a complete command header
+//
+inline int8_t vduArgLength(const uint8_t * header, uint8_t length) {
+	switch (length) {
+		case 1:
+			return header[0] < 32 ? vduArgLengths[header[0]] : 0;
+		case 2:
+			return header[1] < 32 ? vduSysArgLengths[header[1]] : 8;
+	}
+	return vduSysVideoArgLength(header[2]);
+}
+
+#endif // VDU_LENGTHS_H
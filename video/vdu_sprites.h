@@ -24,8 +24,10 @@ void VDUStreamProcessor::vdu_sys_sprites(void) {
 
 		case 1:		// Send bitmap data
 		case 2: {	// Define bitmap in single color
-			auto rw = readWord_t(); if (rw == -1) return;
-			auto rh = readWord_t(); if (rh == -1) return;
+			uint8_t args[4];
+			if (!readArgs_t(args, sizeof args)) return;
+			auto rw = argWord(&args[0]);
+			auto rh = argWord(&args[2]);
 
 			if (rw == 0 && rh == 0) {
 				// TODO support defining bitmap from screen area
@@ -39,8 +41,10 @@ void VDUStreamProcessor::vdu_sys_sprites(void) {
 		}	break;
 
 		case 3: {	// Draw bitmap to screen (x,y)
-			auto rx = readWord_t(); if (rx == -1) return;
-			auto ry = readWord_t(); if (ry == -1) return;
+			uint8_t args[4];
+			if (!readArgs_t(args, sizeof args)) return;
+			auto rx = argWord(&args[0]);
+			auto ry = argWord(&args[2]);
 
 			drawBitmap(rx,ry);
 			debug_log("vdu_sys_sprites: bitmap %d draw command\n\r", getCurrentBitmapId());
@@ -108,15 +112,19 @@ void VDUStreamProcessor::vdu_sys_sprites(void) {
 		}	break;
 
 		case 13: {	// Move sprite to coordinate on screen
-			auto rx = readWord_t(); if (rx == -1) return;
-			auto ry = readWord_t(); if (ry == -1) return;
+			uint8_t args[4];
+			if (!readArgs_t(args, sizeof args)) return;
+			auto rx = argWord(&args[0]);
+			auto ry = argWord(&args[2]);
 			moveSprite(rx, ry);
 			debug_log("vdu_sys_sprites: sprite %d - move to (%d,%d)\n\r", getCurrentSprite(), rx, ry);
 		}	break;
 
 		case 14: {	// Move sprite by offset to current coordinate on screen
-			auto rx = readWord_t(); if (rx == -1) return;
-			auto ry = readWord_t(); if (ry == -1) return;
+			uint8_t args[4];
+			if (!readArgs_t(args, sizeof args)) return;
+			auto rx = argWord(&args[0]);
+			auto ry = argWord(&args[2]);
 			moveSpriteBy(rx, ry);
 			debug_log("vdu_sys_sprites: sprite %d - move by offset (%d,%d)\n\r", getCurrentSprite(), rx, ry);
 		}	break;
@@ -146,9 +154,11 @@ void VDUStreamProcessor::vdu_sys_sprites(void) {
 		}	break;
 
 		case 0x21: {	// Create bitmap from buffer
-			auto width = readWord_t(); if (width == -1) return;
-			auto height = readWord_t(); if (height == -1) return;
-			auto format = readByte_t(); if (format == -1) return;
+			uint8_t args[5];
+			if (!readArgs_t(args, sizeof args)) return;
+			auto width = argWord(&args[0]);
+			auto height = argWord(&args[2]);
+			auto format = args[4];
 			createBitmapFromBuffer(getCurrentBitmapId(), format, width, height);
 		}	break;
 
@@ -214,18 +224,20 @@ void VDUStreamProcessor::receiveBitmap(uint8_t cmd, uint16_t width, uint16_t hei
 void VDUStreamProcessor::createBitmapFromBuffer(uint16_t bufferId, uint8_t format, uint16_t width, uint16_t height) {
 	clearBitmap(bufferId);
 	// do we have a buffer with this ID?
-	if (buffers.find(bufferId) == buffers.end()) {
+	auto buffer = buffers.find(bufferId);
+	if (buffer == buffers.end()) {
 		debug_log("vdu_sys_sprites: buffer %d not found\n\r", bufferId);
 		return;
 	}
+	buffer->second.touch();
 	// is this a singular buffer we can use for a bitmap source?
-	if (buffers[bufferId].size() != 1) {
+	if (buffer->second.size() != 1) {
 		debug_log("vdu_sys_sprites: buffer %d is not a singular buffer and cannot be used for a bitmap source\n\r", bufferId);
 		return;
 	}
 
 	// create bitmap from buffer
-	auto stream = buffers[bufferId][0];
+	auto stream = buffer->second[0];
 	// map our pixel format, default to RGBA8888
 	PixelFormat pixelFormat = PixelFormat::RGBA8888;
 	auto bytesPerPixel = 4.;
@@ -254,7 +266,12 @@ void VDUStreamProcessor::createBitmapFromBuffer(uint16_t bufferId, uint8_t forma
 		debug_log("vdu_sys_sprites: buffer %d - stream length %d does not match expected length %f\n\r", bufferId, streamLength, expectedLength);
 		return;
 	}
-	auto data = stream->getBuffer();
+	// the bitmap uses the buffer's data directly, so it must not be shared with copies of the buffer
+	auto data = stream->getPinnedBuffer();
+	if (!data) {
+		debug_log("vdu_sys_sprites: buffer %d - failed to copy shared data\n\r", bufferId);
+		return;
+	}
 	bitmaps[bufferId] = make_shared_psram<Bitmap>(width, height, (uint8_t *)data, pixelFormat);
 	debug_log("vdu_sys_sprites: bitmap created for bufferId %d, format %d, (%dx%d)\n\r", bufferId, format, width, height);
 }
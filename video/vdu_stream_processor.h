@@ -7,19 +7,56 @@
 #include "agon.h"
 #include "agon_ps2.h"
 #include "buffer_stream.h"
+#include "decoded_buffer.h"
+#include "multi_buffer_stream.h"
+#include "perf_counters.h"
 #include "types.h"
+#include "vdu_lengths.h"
 #include "viewport.h"
 
+struct BufferCondition;
+struct CallFrame;
+
 class VDUStreamProcessor {
 	private:
 		std::shared_ptr<Stream> inputStream;
 		std::shared_ptr<Stream> outputStream;
 		std::shared_ptr<Stream> originalOutputStream;
 
+		uint8_t commandHeader[3] = {};		// Bytes identifying the command waiting to be dispatched
+		uint8_t commandHeaderLength = 0;	// Number of header bytes read so far
+		uint32_t commandStartTime = 0;		// When the first byte of the pending command arrived
+		uint8_t commandTimeouts = 0;		// Reads that timed out while running the current command
+
+		bool resyncEnabled = false;			// A resync marker has been seen, so desyncs can be recovered from
+		bool resyncing = false;				// Discarding input until the next resync marker
+		uint8_t resyncMatched = 0;			// Number of marker bytes matched so far
+		uint32_t resyncDiscarded = 0;		// Bytes discarded while resyncing
+
+		DecodedBufferStream * decodedStream = nullptr;	// The input stream, when running a decoded buffer
+		uint32_t decodedChanges = 0;		// Buffer changes seen while running a decoded buffer
+		CallFrame * callFrame = nullptr;	// The call frame we're running in, if any
+
+		void dispatchCommand();
+		void dispatch(const uint8_t * header, uint8_t length);
+		void setDecodedInput(std::shared_ptr<DecodedBufferStream> stream);
+		void setBufferInput(uint16_t bufferId, uint32_t offset);
+		void setBlockInput(const std::vector<std::shared_ptr<BufferStream>> & blocks, uint32_t offset, BufferArguments * arguments = nullptr);
+		void processDecodedCommand();
+		void resync();
+		void sendResyncEvent(uint8_t event, uint8_t * header, uint8_t headerLength);
+
+		inline void countTimeout() {
+			commandTimeouts++;
+			PERF_COUNT_TIMEOUT();
+		}
+
 		int16_t readByte_t(uint16_t timeout);
 		int32_t readWord_t(uint16_t timeout);
 		int32_t read24_t(uint16_t timeout);
+		int64_t readValue_t(uint8_t width, uint16_t timeout);
 		uint8_t readByte_b();
+		bool readArgs_t(uint8_t * args, uint8_t length, uint16_t timeout);
 		uint32_t readIntoBuffer(uint8_t * buffer, uint32_t length, uint16_t timeout);
 		uint32_t discardBytes(uint32_t length, uint16_t timeout);
 
@@ -35,7 +72,9 @@ class VDUStreamProcessor {
 		void vdu_cursorTab();
 
 		void vdu_sys();
+		void vdu_sys(uint8_t mode);
 		void vdu_sys_video();
+		void vdu_sys_video(uint8_t mode);
 		void sendGeneralPoll();
 		void vdu_sys_video_kblayout();
 		void sendCursorPosition();
@@ -46,6 +85,13 @@ class VDUStreamProcessor {
 		void sendKeyboardState();
 		void vdu_sys_keystate();
 		void vdu_sys_mouse();
+		void sendRxStats();
+		void sendTxStats();
+		void sendPerfStats();
+		void vdu_sys_resync();
+		void vdu_sys_baudrate();
+		void sendBaudRate(uint8_t status, uint32_t baudRate);
+		void vdu_sys_frame(bool compressed);
 		void vdu_sys_scroll();
 		void vdu_sys_cursorBehaviour();
 		void vdu_sys_udg(char c);
@@ -66,7 +112,17 @@ class VDUStreamProcessor {
 
 		void vdu_sys_buffered();
 		uint32_t bufferWrite(uint16_t bufferId, uint32_t size);
+		uint32_t bufferWriteCompressed(uint16_t bufferId, uint32_t compressedSize, uint32_t size);
+		uint32_t bufferWriteLarge(uint16_t bufferId, uint32_t size, uint32_t offset);
+		void sendBufferWriteStatus(uint16_t bufferId, uint8_t status, uint32_t offset, uint32_t size);
 		void bufferCall(uint16_t bufferId, uint32_t offset);
+		void bufferLoop(uint16_t bufferId, uint16_t count, BufferCondition * condition);
+		void bufferSetParameters(uint16_t bufferId);
+		void bufferCallWithArguments(uint16_t bufferId, uint16_t * arguments, uint8_t count);
+		CallFrame * enterCallFrame(uint16_t bufferId);
+		void runCallFrame(CallFrame * frame, uint16_t bufferId, uint32_t offset);
+		void leaveCallFrame(CallFrame * frame);
+		void sendCallDepthError(uint16_t bufferId);
 		void bufferClear(uint16_t bufferId);
 		std::shared_ptr<WritableBufferStream> bufferCreate(uint16_t bufferId, uint32_t size);
 		void setOutputStream(uint16_t bufferId);
@@ -74,14 +130,30 @@ class VDUStreamProcessor {
 		std::vector<uint16_t> getBufferIdsFromStream();
 		int16_t getBufferByte(uint16_t bufferId, uint32_t offset);
 		bool setBufferByte(uint8_t value, uint16_t bufferId, uint32_t offset);
+		int64_t getBufferValue(uint16_t bufferId, uint32_t offset, uint8_t width);
+		bool setBufferValue(uint32_t value, uint16_t bufferId, uint32_t offset, uint8_t width);
 		void bufferAdjust(uint16_t bufferId);
+		int16_t bufferAdjustSpans(uint8_t op, uint16_t bufferId, uint32_t offset, uint32_t count, bool useMultiOperand, bool useBufferValue, uint16_t operandBufferId, uint32_t operandOffset, uint8_t operandValue);
+		void bufferAdjustValues(uint8_t op, uint16_t bufferId, uint32_t offset, uint32_t count, bool useMultiTarget, bool useMultiOperand, bool useBufferValue, uint16_t operandBufferId, uint32_t operandOffset);
 		bool bufferConditional();
+		bool readCondition(BufferCondition & condition);
+		bool checkCondition(BufferCondition & condition);
+		void bufferRegister(uint16_t bufferId);
+		int64_t readRegisterOperand(uint8_t command);
+		bool registerConditional();
 		void bufferJump(uint16_t bufferId, uint32_t offset);
 		void bufferCopy(uint16_t bufferId, std::vector<uint16_t> sourceBufferIds);
+		void sendBufferSharingStats(uint16_t bufferId);
+		void sendBufferMemoryStats(uint16_t bufferId, uint8_t count);
+		void bufferSetCacheable(uint16_t bufferId, bool cacheable);
+		void bufferSetQuota(uint32_t quota);
+		void sendEvictedBuffers();
+		void sendBufferPoolStats();
 		void bufferConsolidate(uint16_t bufferId);
 		void bufferSplitInto(uint16_t bufferId, uint16_t length, std::vector<uint16_t> newBufferIds, bool iterate);
 		void bufferSplitByInto(uint16_t bufferId, uint16_t width, uint16_t chunkCount, std::vector<uint16_t> newBufferIds, bool iterate);
 		void bufferSpreadInto(uint16_t bufferId, std::vector<uint16_t> newBufferIds, bool iterate);
+		void bufferInterleave(uint16_t bufferId, uint16_t width, std::vector<uint16_t> sourceBufferIds);
 		void bufferReverseBlocks(uint16_t bufferId);
 		void bufferReverse(uint16_t bufferId, uint8_t options);
 
@@ -101,12 +173,16 @@ class VDUStreamProcessor {
 		inline bool byteAvailable() {
 			return inputStream->available() > 0;
 		}
+		inline bool commandPending() {
+			return commandHeaderLength > 0;
+		}
 		inline uint8_t readByte() {
+			PERF_COUNT_READ(1);
 			return inputStream->read();
 		}
 		inline void writeByte(uint8_t b) {
 			if (outputStream) {
-				outputStream->write(b);
+				VDPPacketWriter.write(outputStream.get(), b);
 			}
 		}
 		void send_packet(uint8_t code, uint16_t len, uint8_t data[]);
@@ -133,7 +209,9 @@ int16_t VDUStreamProcessor::readByte_t(uint16_t timeout = COMMS_TIMEOUT) {
 		if (byteAvailable()) {
 			return readByte();
 		}
+		VDPPacketWriter.flush();	// Anything we're waiting on may be a reply to what we've sent
 	}
+	countTimeout();
 	return -1;
 }
 
@@ -170,10 +248,73 @@ int32_t VDUStreamProcessor::read24_t(uint16_t timeout = COMMS_TIMEOUT) {
 	return -1;
 }
 
+// Read a command's complete argument block from the serial port, with a timeout
+// The timeout covers the whole block rather than each individual byte,
+// and bytes are pulled from the stream in bulk as they become available
+// Returns:
+// - true if all bytes were read, otherwise false
+//
+bool VDUStreamProcessor::readArgs_t(uint8_t * args, uint8_t length, uint16_t timeout = COMMS_TIMEOUT) {
+	uint8_t remaining = length;
+	auto t = millis();
+
+	while (remaining > 0) {
+		auto available = inputStream->available();
+		if (available > 0) {
+			if (available > remaining) {
+				available = remaining;
+			}
+			inputStream->readBytes(args, available);
+			PERF_COUNT_READ(available);
+			args += available;
+			remaining -= available;
+		} else if (millis() - t > timeout) {
+			debug_log("readArgs_t: timed out (%d of %d bytes remaining)\n\r", remaining, length);
+			countTimeout();
+			return false;
+		} else {
+			VDPPacketWriter.flush();
+		}
+	}
+	return true;
+}
+
+// Decode little-endian values from an argument block
+//
+inline uint16_t argWord(uint8_t * args) {
+	return args[0] | (args[1] << 8);
+}
+
+inline uint32_t arg24(uint8_t * args) {
+	return args[0] | (args[1] << 8) | (args[2] << 16);
+}
+
+inline uint32_t argValue(uint8_t * args, uint8_t width) {
+	uint32_t value = 0;
+	for (auto i = 0; i < width; i++) {
+		value |= (uint32_t)args[i] << (i * 8);
+	}
+	return value;
+}
+
+// Read an unsigned little-endian value of 1 to 4 bytes from the serial port, with a timeout
+// Returns:
+// - Value if all bytes read, otherwise -1
+//
+int64_t VDUStreamProcessor::readValue_t(uint8_t width, uint16_t timeout = COMMS_TIMEOUT) {
+	uint8_t args[4];
+	if (!readArgs_t(args, width, timeout)) {
+		return -1;
+	}
+	return argValue(args, width);
+}
+
 // Read an unsigned byte from the serial port (blocking)
 //
 uint8_t VDUStreamProcessor::readByte_b() {
-	while (inputStream->available() == 0);
+	while (inputStream->available() == 0) {
+		VDPPacketWriter.flush();
+	}
 	return readByte();
 }
 
@@ -196,6 +337,7 @@ uint32_t VDUStreamProcessor::readIntoBuffer(uint8_t * buffer, uint32_t length, u
 		now = xTaskGetTickCountFromISR();
 		if (now - t > timeCheck) {
 			debug_log("readIntoBuffer: timed out\n\r");
+			countTimeout();
 			return remaining;
 		}
 		auto available = inputStream->available();
@@ -205,9 +347,12 @@ uint32_t VDUStreamProcessor::readIntoBuffer(uint8_t * buffer, uint32_t length, u
 			}
 			// debug_log("readIntoBuffer: reading %d bytes\n\r", available);
 			inputStream->readBytes(buffer, available);
+			PERF_COUNT_READ(available);
 			buffer += available;
 			remaining -= available;
 			t = now;
+		} else {
+			VDPPacketWriter.flush();
 		}
 	}
 	return remaining;
@@ -215,18 +360,18 @@ uint32_t VDUStreamProcessor::readIntoBuffer(uint8_t * buffer, uint32_t length, u
 
 // Discard a given number of bytes from input stream
 // Returns 0 on success, or the number of bytes remaining if timed out
+// Uses a buffer on the stack, as it's used to recover from running out of memory
 //
 uint32_t VDUStreamProcessor::discardBytes(uint32_t length, uint16_t timeout = COMMS_TIMEOUT) {
 	uint32_t remaining = length;
-	auto bufferSize = 64;
-	auto readSize = bufferSize;
-	auto buffer = make_unique_psram_array<uint8_t>(bufferSize);
+	uint8_t buffer[64];
+	uint32_t readSize = sizeof buffer;
 
 	while (remaining > 0) {
 		if (remaining < readSize) {
 			readSize = remaining;
 		}
-		if (readIntoBuffer(buffer.get(), readSize, timeout) != 0) {
+		if (readIntoBuffer(buffer, readSize, timeout) != 0) {
 			// timed out
 			return remaining;
 		}
@@ -236,12 +381,11 @@ uint32_t VDUStreamProcessor::discardBytes(uint32_t length, uint16_t timeout = CO
 }
 
 // Send a packet of data to the MOS
+// Packets are staged by VDPPacketWriter, and reach the serial port when it is flushed
 //
 void VDUStreamProcessor::send_packet(uint8_t code, uint16_t len, uint8_t data[]) {
-	writeByte(code + 0x80);
-	writeByte(len);
-	for (int i = 0; i < len; i++) {
-		writeByte(data[i]);
+	if (outputStream) {
+		VDPPacketWriter.send(outputStream.get(), code, len, data);
 	}
 }
 
@@ -284,15 +428,167 @@ void VDUStreamProcessor::sendMouseData(MouseDelta * delta = nullptr) {
 //
 void VDUStreamProcessor::processAllAvailable() {
 	while (byteAvailable()) {
-		vdu(readByte());
+		if (decodedStream) {
+			processDecodedCommand();
+		} else {
+			vdu(readByte());
+		}
 	}
 }
 
+// Use a decoded buffer as the input stream
+//
+void VDUStreamProcessor::setDecodedInput(std::shared_ptr<DecodedBufferStream> stream) {
+	inputStream = stream;
+	decodedStream = stream.get();
+	decodedChanges = BufferStream::changes;
+}
+
+// Process the next command from a decoded buffer
+// If the buffer's contents change while it's running, we carry on from the buffer's blocks
+// themselves, so that the changes are seen just as they would be without decoding
+//
+void VDUStreamProcessor::processDecodedCommand() {
+	auto & decoded = decodedStream->decoded;
+	if (BufferStream::changes != decodedChanges) {
+		decodedChanges = BufferStream::changes;
+		if (!decoded->isUnchanged()) {
+			setBlockInput(decoded->getBlocks(), decodedStream->tell(), decodedStream->getArguments());
+			return;
+		}
+	}
+	vdu(readByte());
+}
+
 // Process next command from the stream
+// Fixed-length commands are only dispatched once all of their bytes have arrived,
+// so a stalled sender leaves us free to return to the main loop rather than
+// blocking part-way through a command
+//
+// Packets sent by the command are flushed to the serial port once it has run, along with
+// a report of any cacheable buffers it evicted
+//
+// If the host has sent a resync marker, a command that times out part-way through
+// leaves us out of step with the host, so input is then discarded until the next marker
 //
 void VDUStreamProcessor::processNext() {
-	if (byteAvailable()) {
-		vdu(readByte());
+	if (resyncing) {
+		resync();
+		return;
+	}
+	if (!commandPending()) {
+		if (!byteAvailable()) {
+			return;
+		}
+		commandStartTime = millis();
+	}
+	bool timedOut = millis() - commandStartTime > COMMS_TIMEOUT;
+
+	// Collect the bytes that identify the command
+	while (commandHeaderLength < vduHeaderLength(commandHeader, commandHeaderLength)) {
+		if (!byteAvailable()) {
+			if (timedOut) {
+				debug_log("processNext: timed out waiting for command header\n\r");
+				if (resyncEnabled) {
+					resyncing = true;
+					sendResyncEvent(RESYNC_EVENT_DESYNC, commandHeader, commandHeaderLength);
+					VDPPacketWriter.flush();
+				}
+				commandHeaderLength = 0;
+			}
+			return;
+		}
+		commandHeader[commandHeaderLength++] = readByte();
+	}
+
+	// Wait for its arguments, unless they are variable length or the sender has stalled
+	auto length = vduArgLength(commandHeader, commandHeaderLength);
+	if (length != VDU_VARIABLE_LENGTH && inputStream->available() < length && !timedOut) {
+		return;
+	}
+	uint8_t header[3];
+	auto headerLength = commandHeaderLength;
+	memcpy(header, commandHeader, headerLength);
+	commandTimeouts = 0;
+	dispatchCommand();
+	sendEvictedBuffers();
+	if (commandTimeouts > 0 && resyncEnabled) {
+		debug_log("processNext: command timed out, resyncing\n\r");
+		resyncing = true;
+		sendResyncEvent(RESYNC_EVENT_DESYNC, header, headerLength);
+	}
+	VDPPacketWriter.flush();
+}
+
+// Discard input until a complete resync marker has been read
+//
+void VDUStreamProcessor::resync() {
+	static const uint8_t marker[] = RESYNC_MARKER;
+
+	while (byteAvailable()) {
+		auto b = readByte();
+		resyncDiscarded++;
+		// The first marker byte doesn't appear again in the marker, so a mismatch can only restart it
+		if (b == marker[resyncMatched]) {
+			resyncMatched++;
+		} else {
+			resyncMatched = b == marker[0] ? 1 : 0;
+		}
+		if (resyncMatched == sizeof marker) {
+			debug_log("resync: resynchronised after %d bytes\n\r", resyncDiscarded);
+			sendResyncEvent(RESYNC_EVENT_RESYNC, nullptr, 0);
+			VDPPacketWriter.flush();
+			resyncing = false;
+			resyncMatched = 0;
+			resyncDiscarded = 0;
+			return;
+		}
+	}
+}
+
+// Report a desync or resync to the host
+// The packet holds the event, the header of the command that timed out (padded with zeros),
+// and the number of bytes discarded so far, including the marker
+//
+void VDUStreamProcessor::sendResyncEvent(uint8_t event, uint8_t * header, uint8_t headerLength) {
+	uint8_t packet[] = {
+		event,
+		0, 0, 0,
+		(uint8_t)(resyncDiscarded & 0xFF),
+		(uint8_t)((resyncDiscarded >> 8) & 0xFF),
+		(uint8_t)((resyncDiscarded >> 16) & 0xFF),
+		(uint8_t)((resyncDiscarded >> 24) & 0xFF),
+	};
+	if (headerLength > 0) {
+		memcpy(&packet[1], header, headerLength);
+	}
+	send_packet(PACKET_RESYNC, sizeof packet, packet);
+}
+
+// Dispatch a command whose header has been read by processNext
+//
+void VDUStreamProcessor::dispatchCommand() {
+	auto length = commandHeaderLength;
+	commandHeaderLength = 0;
+	dispatch(commandHeader, length);
+}
+
+// Run a command, given its header bytes
+// The input stream must be positioned just after the header
+//
+void VDUStreamProcessor::dispatch(const uint8_t * header, uint8_t length) {
+	if (length == 1) {
+		vdu(header[0]);
+		return;
+	}
+	if (consoleMode) {
+		DBGSerial.write(header[0]);
+	}
+	PERF_SCOPE(perfVDUCounter(header[0]));
+	if (length == 2) {
+		vdu_sys(header[1]);
+	} else {
+		vdu_sys_video(header[2]);
 	}
 }
 
@@ -10,6 +10,7 @@
 #include "agon_ps2.h"
 #include "cursor.h"
 #include "graphics.h"
+#include "lz4.h"
 #include "vdu_audio.h"
 #include "vdu_buffered.h"
 #include "vdu_sprites.h"
@@ -50,6 +51,7 @@ void VDUStreamProcessor::wait_eZ80() {
 			auto c = readByte();	// Only handle VDU 23 packets
 			if (c == 23) {
 				vdu_sys();
+				VDPPacketWriter.flush();
 			}
 		}
 	}
@@ -68,10 +70,16 @@ void VDUStreamProcessor::vdu_sys() {
 	if (mode == -1) {
 		return;
 	}
+	vdu_sys(mode);
+}
+
+// VDU 23,mode with the mode byte already read
+//
+void VDUStreamProcessor::vdu_sys(uint8_t mode) {
 	//
 	// If mode < 32, then it's a system command
 	//
-	else if (mode < 32) {
+	if (mode < 32) {
 		switch (mode) {
 			case 0x00: {					// VDU 23, 0
 	  			vdu_sys_video();			// Video system control
@@ -111,7 +119,16 @@ void VDUStreamProcessor::vdu_sys() {
 //
 void VDUStreamProcessor::vdu_sys_video() {
 	auto mode = readByte_t();
+	if (mode == -1) {
+		return;
+	}
+	vdu_sys_video(mode);
+}
 
+// VDU 23,0,mode with the mode byte already read
+//
+void VDUStreamProcessor::vdu_sys_video(uint8_t mode) {
+	PERF_SCOPE(perfSys[mode]);
 	switch (mode) {
 		case VDP_GP: {					// VDU 23, 0, &80
 			sendGeneralPoll();			// Send a general poll packet
@@ -123,14 +140,14 @@ void VDUStreamProcessor::vdu_sys_video() {
 			sendCursorPosition();		// Send cursor position
 		}	break;
 		case VDP_SCRCHAR: {				// VDU 23, 0, &83, x; y;
-			auto x = readWord_t();		// Get character at screen position x, y
-			auto y = readWord_t();
-			sendScreenChar(x, y);
+			uint8_t args[4];			// Get character at screen position x, y
+			if (!readArgs_t(args, sizeof args)) return;
+			sendScreenChar(argWord(&args[0]), argWord(&args[2]));
 		}	break;
 		case VDP_SCRPIXEL: {			// VDU 23, 0, &84, x; y;
-			auto x = readWord_t();		// Get pixel value at screen position x, y
-			auto y = readWord_t();
-			sendScreenPixel((short)x, (short)y);
+			uint8_t args[4];			// Get pixel value at screen position x, y
+			if (!readArgs_t(args, sizeof args)) return;
+			sendScreenPixel((short)argWord(&args[0]), (short)argWord(&args[2]));
 		}	break;		
 		case VDP_AUDIO: {				// VDU 23, 0, &85, channel, command, <args>
 			vdu_sys_audio();
@@ -147,12 +164,36 @@ void VDUStreamProcessor::vdu_sys_video() {
 		case VDP_MOUSE: {				// VDU 23, 0, &89, command, <args>
 			vdu_sys_mouse();
 		}	break;
+		case VDP_RXSTATS: {				// VDU 23, 0, &8A, reset
+			sendRxStats();				// Send receive ring statistics
+		}	break;
+		case VDP_TXSTATS: {				// VDU 23, 0, &8B, packetType, reset
+			sendTxStats();				// Send outbound packet statistics
+		}	break;
+		case VDP_PERFSTATS: {			// VDU 23, 0, &8C, table, code
+			sendPerfStats();			// Send performance counters for a command
+		}	break;
+		case VDP_PERFRESET: {			// VDU 23, 0, &8D
+			resetPerfCounters();
+		}	break;
+		case VDP_RESYNC: {				// VDU 23, 0, &8E, "SYNC"
+			vdu_sys_resync();
+		}	break;
+		case VDP_BAUDRATE: {			// VDU 23, 0, &8F, baudRate (4 bytes)
+			vdu_sys_baudrate();
+		}	break;
 		case VDP_BUFFERED: {			// VDU 23, 0, &A0, bufferId; command, <args>
 			vdu_sys_buffered();
 		}	break;
 		case VDP_UPDATER: {				// VDU 23, 0, &A1, command, <args>
 			vdu_sys_updater();
 		}	break;
+		case VDP_FRAME: {				// VDU 23, 0, &A2, length; <data> checksum
+			vdu_sys_frame(false);
+		}	break;
+		case VDP_COMPRESSED_FRAME: {	// VDU 23, 0, &A3, compressedLength; length; <data> checksum
+			vdu_sys_frame(true);
+		}	break;
 		case VDP_LOGICALCOORDS: {		// VDU 23, 0, &C0, n
 			auto b = readByte_t();		// Set logical coord mode
 			if (b >= 0) {
@@ -280,14 +321,15 @@ void VDUStreamProcessor::vdu_sys_video_time() {
 		sendTime();
 	}
 	else if (mode == 1) {
-		auto yr = readByte_t(); if (yr == -1) return;
-		auto mo = readByte_t(); if (mo == -1) return;
-		auto da = readByte_t(); if (da == -1) return;
-		auto ho = readByte_t(); if (ho == -1) return;	
-		auto mi = readByte_t(); if (mi == -1) return;
-		auto se = readByte_t(); if (se == -1) return;
+		uint8_t args[6];
+		if (!readArgs_t(args, sizeof args)) return;
+		auto mo = args[1];
+		auto da = args[2];
+		auto ho = args[3];
+		auto mi = args[4];
+		auto se = args[5];
 
-		yr = EPOCH_YEAR + (int8_t)yr;
+		auto yr = EPOCH_YEAR + (int8_t)args[0];
 
 		if (yr >= 1970) {
 			rtc.setTime(se, mi, ho, da, mo, yr);
@@ -316,9 +358,11 @@ void VDUStreamProcessor::sendKeyboardState() {
 // Send 255 for LEDs to leave them unchanged
 //
 void VDUStreamProcessor::vdu_sys_keystate() {
-	auto delay = readWord_t(); if (delay == -1) return;
-	auto rate = readWord_t(); if (rate == -1) return;
-	auto ledState = readByte_t(); if (ledState == -1) return;
+	uint8_t args[5];
+	if (!readArgs_t(args, sizeof args)) return;
+	auto delay = argWord(&args[0]);
+	auto rate = argWord(&args[2]);
+	auto ledState = args[4];
 
 	setKeyboardState(delay, rate, ledState);
 	debug_log("vdu_sys_video: keystate: delay=%d, rate=%d, led=%d\n\r", kbRepeatDelay, kbRepeatRate, ledState);
@@ -379,8 +423,10 @@ void VDUStreamProcessor::vdu_sys_mouse() {
 		}	break;
 
 		case MOUSE_SET_POSITION: {
-			auto x = readWord_t();	if (x == -1) return;
-			auto y = readWord_t();	if (y == -1) return;
+			uint8_t args[4];
+			if (!readArgs_t(args, sizeof args)) return;
+			auto x = argWord(&args[0]);
+			auto y = argWord(&args[2]);
 			// normalise coordinates
 			auto p = translateCanvas(scale(x, y));
 
@@ -393,10 +439,8 @@ void VDUStreamProcessor::vdu_sys_mouse() {
 		}	break;
 
 		case MOUSE_SET_AREA: {
-			auto x = readWord_t();	if (x == -1) return;
-			auto y = readWord_t();	if (y == -1) return;
-			auto x2 = readWord_t();	if (x2 == -1) return;
-			auto y2 = readWord_t();	if (y2 == -1) return;
+			uint8_t args[8];
+			if (!readArgs_t(args, sizeof args)) return;
 
 			debug_log("vdu_sys_mouse: set area can't be properly supported with current fab-gl\n\r");
 			// TODO set area to width/height using bottom/right only
@@ -452,15 +496,240 @@ void VDUStreamProcessor::vdu_sys_mouse() {
 				return;
 			}
 		}	break;
+
+		case MOUSE_SET_REPORTINTERVAL: {
+			auto interval = readByte_t();	if (interval == -1) return;
+			if (setMouseReportInterval(interval)) {
+				// success so send new data packet (triggering VDP flag)
+				sendMouseData();
+				debug_log("vdu_sys_mouse: set report interval %d\n\r", interval);
+			}
+		}	break;
+	}
+}
+
+// VDU 23, 0, &8A, reset: Send receive ring statistics
+// Sending a non-zero reset value clears the peak level and counters once they have been sent
+//
+void VDUStreamProcessor::sendRxStats() {
+	auto reset = readByte_t(); if (reset == -1) return;
+
+	RxRingStats stats;
+	VDPRxStream.getStats(&stats);
+	uint32_t values[] = {
+		stats.size,
+		stats.level,
+		stats.peakLevel,
+		stats.received,
+		stats.throttled,
+	};
+	uint8_t packet[sizeof values];
+	for (size_t i = 0; i < sizeof values / sizeof values[0]; i++) {
+		packet[i * 4]     = values[i] & 0xFF;
+		packet[i * 4 + 1] = (values[i] >> 8) & 0xFF;
+		packet[i * 4 + 2] = (values[i] >> 16) & 0xFF;
+		packet[i * 4 + 3] = (values[i] >> 24) & 0xFF;
+	}
+	send_packet(PACKET_RXSTATS, sizeof packet, packet);
+
+	if (reset) {
+		VDPRxStream.resetStats();
+	}
+}
+
+// VDU 23, 0, &8B, packetType, reset: Send outbound packet statistics
+// Reports packets, bytes and flushes for one packet type, or totals across all types for &FF
+// Sending a non-zero reset value clears the counters for every type once they have been sent
+//
+void VDUStreamProcessor::sendTxStats() {
+	uint8_t args[2];
+	if (!readArgs_t(args, sizeof args)) return;
+	auto packetType = args[0];
+	auto reset = args[1];
+
+	PacketStats stats;
+	if (packetType == 0xFF) {
+		VDPPacketWriter.getTotals(&stats);
+	} else {
+		VDPPacketWriter.getStats(packetType, &stats);
+	}
+	uint32_t values[] = {
+		stats.packets,
+		stats.bytes,
+		stats.flushes,
+	};
+	uint8_t packet[1 + sizeof values];
+	packet[0] = packetType;
+	for (size_t i = 0; i < sizeof values / sizeof values[0]; i++) {
+		packet[1 + i * 4]     = values[i] & 0xFF;
+		packet[1 + i * 4 + 1] = (values[i] >> 8) & 0xFF;
+		packet[1 + i * 4 + 2] = (values[i] >> 16) & 0xFF;
+		packet[1 + i * 4 + 3] = (values[i] >> 24) & 0xFF;
+	}
+	send_packet(PACKET_TXSTATS, sizeof packet, packet);
+
+	if (reset) {
+		VDPPacketWriter.resetStats();
+	}
+}
+
+// VDU 23, 0, &8E, "SYNC": Resync marker
+// When in step with the host this does nothing, other than enabling desync recovery
+//
+void VDUStreamProcessor::vdu_sys_resync() {
+	static const uint8_t marker[] = RESYNC_MARKER;
+	uint8_t args[RESYNC_MARKER_LENGTH - 3];
+	if (!readArgs_t(args, sizeof args)) return;
+
+	if (memcmp(args, &marker[3], sizeof args) == 0) {
+		resyncEnabled = true;
+	}
+}
+
+// VDU 23, 0, &8F, baudRate (4 bytes): Switch to a new baud rate
+// We acknowledge at the current rate, then switch. The host switches once it has the
+// acknowledgement, and confirms by sending the same command again at the new rate.
+// If that doesn't arrive in time, we go back to the previous rate.
+//
+void VDUStreamProcessor::vdu_sys_baudrate() {
+	uint8_t args[4];
+	if (!readArgs_t(args, sizeof args)) return;
+	uint32_t baudRate = args[0] | (args[1] << 8) | (args[2] << 16) | (args[3] << 24);
+
+	// Only the host can change the rate, not a buffered command or a frame
+	if (inputStream.get() != getVDPStream() || baudRate < UART_BR_MIN || baudRate > UART_BR_MAX) {
+		debug_log("vdu_sys_baudrate: refused %d\n\r", baudRate);
+		sendBaudRate(BAUDRATE_REFUSED, VDPBaudRate);
+		return;
+	}
+	auto previousRate = VDPBaudRate;
+	sendBaudRate(BAUDRATE_SWITCHING, baudRate);
+	setVDPBaudRate(baudRate);
+
+	// Wait for the confirmation, skipping anything garbled by the switch
+	// The last bytes received are kept in a window the size of the confirmation and compared
+	// as a whole, so a match is found wherever it starts (the rate itself may contain 0x17)
+	uint8_t confirm[] = { 0x17, 0x00, VDP_BAUDRATE, args[0], args[1], args[2], args[3] };
+	uint8_t window[sizeof confirm];
+	uint8_t received = 0;
+	auto t = millis();
+	while (millis() - t <= UART_BR_CONFIRM_TIMEOUT) {
+		if (!byteAvailable()) {
+			continue;
+		}
+		memmove(window, window + 1, sizeof window - 1);
+		window[sizeof window - 1] = readByte();
+		if (received < sizeof window) {
+			received++;
+		}
+		if (received == sizeof window && memcmp(window, confirm, sizeof confirm) == 0) {
+			debug_log("vdu_sys_baudrate: switched to %d\n\r", baudRate);
+			sendBaudRate(BAUDRATE_CONFIRMED, baudRate);
+			return;
+		}
+	}
+	debug_log("vdu_sys_baudrate: no confirmation at %d, falling back to %d\n\r", baudRate, previousRate);
+	setVDPBaudRate(previousRate);
+	sendBaudRate(BAUDRATE_FALLBACK, previousRate);
+}
+
+void VDUStreamProcessor::sendBaudRate(uint8_t status, uint32_t baudRate) {
+	uint8_t packet[] = {
+		status,
+		(uint8_t)(baudRate & 0xFF),
+		(uint8_t)((baudRate >> 8) & 0xFF),
+		(uint8_t)((baudRate >> 16) & 0xFF),
+		(uint8_t)((baudRate >> 24) & 0xFF),
+	};
+	send_packet(PACKET_BAUDRATE, sizeof packet, packet);
+}
+
+// VDU 23, 0, &8C, table, code: Send performance counters for a command
+// Table 0 is VDU codes (where 32 covers every printable character), and table 1 is VDU 23, 0 commands
+// Counters are zero unless the firmware was built with VDP_PERF_COUNTERS set
+//
+void VDUStreamProcessor::sendPerfStats() {
+	uint8_t args[2];
+	if (!readArgs_t(args, sizeof args)) return;
+	auto table = args[0];
+	auto code = args[1];
+
+	PerfCounter counter = {};
+	if (table == 0) {
+		counter = perfVDUCounter(code);
+	} else if (table == 1) {
+		counter = perfSys[code];
+	}
+	uint32_t values[] = {
+		counter.invocations,
+		counter.argBytes,
+		counter.micros,
+		counter.timeouts,
+	};
+	uint8_t packet[2 + sizeof values];
+	packet[0] = table;
+	packet[1] = code;
+	for (size_t i = 0; i < sizeof values / sizeof values[0]; i++) {
+		packet[2 + i * 4]     = values[i] & 0xFF;
+		packet[2 + i * 4 + 1] = (values[i] >> 8) & 0xFF;
+		packet[2 + i * 4 + 2] = (values[i] >> 16) & 0xFF;
+		packet[2 + i * 4 + 3] = (values[i] >> 24) & 0xFF;
+	}
+	send_packet(PACKET_PERFSTATS, sizeof packet, packet);
+}
+
+// VDU 23, 0, &A2, length; <data> checksum: Execute a frame of VDU commands
+// VDU 23, 0, &A3, compressedLength; length; <data> checksum: Execute an LZ4 compressed frame
+// The whole frame is read in one transfer and verified before any of it is run,
+// so it is drawn in one go, and never half drawn if the transfer fails
+// The checksum is chosen so that the bytes sent and checksum add up to zero (mod 256)
+//
+void VDUStreamProcessor::vdu_sys_frame(bool compressed) {
+	auto receiveLength = readWord_t(); if (receiveLength == -1) return;
+	auto length = compressed ? readWord_t() : receiveLength; if (length == -1) return;
+
+	// frames are staged outside the buffer quota, so receiving one never evicts a buffer
+	auto frame = makeStagingStream(receiveLength);
+	if (receiveLength > 0 && !frame->getBuffer()) {
+		debug_log("vdu_sys_frame: failed to allocate %d bytes\n\r", receiveLength);
+		discardBytes(receiveLength + 1);
+		return;
+	}
+	if (readIntoBuffer(frame->getBuffer(), receiveLength) != 0) {
+		debug_log("vdu_sys_frame: timed out reading frame\n\r");
+		return;
+	}
+	auto checksum = readByte_t(); if (checksum == -1) return;
+
+	uint8_t sum = checksum;
+	auto data = frame->getBuffer();
+	for (auto i = 0; i < receiveLength; i++) {
+		sum += data[i];
 	}
+	if (sum != 0) {
+		debug_log("vdu_sys_frame: checksum error, frame discarded\n\r");
+		return;
+	}
+	if (compressed) {
+		frame = lz4DecompressStream(*frame, length, true);
+		if (!frame) {
+			debug_log("vdu_sys_frame: failed to decompress frame\n\r");
+			return;
+		}
+	}
+
+	auto streamProcessor = make_unique_psram<VDUStreamProcessor>(frame, outputStream, 65535);
+	streamProcessor->processAllAvailable();
 }
 
 // VDU 23,7: Scroll rectangle on screen
 //
 void VDUStreamProcessor::vdu_sys_scroll() {
-	auto extent = readByte_t();		if (extent == -1) return;	// Extent (0 = text viewport, 1 = entire screen, 2 = graphics viewport)
-	auto direction = readByte_t();	if (direction == -1) return;	// Direction
-	auto movement = readByte_t();	if (movement == -1) return;	// Number of pixels to scroll
+	uint8_t args[3];
+	if (!readArgs_t(args, sizeof args)) return;
+	auto extent = args[0];		// Extent (0 = text viewport, 1 = entire screen, 2 = graphics viewport)
+	auto direction = args[1];	// Direction
+	auto movement = args[2];	// Number of pixels to scroll
 
 	// Extent matches viewport constant defs (plus 3=active)
 	Rect * region = getViewport(extent);
@@ -472,10 +741,10 @@ void VDUStreamProcessor::vdu_sys_scroll() {
 // VDU 23,16: Set cursor behaviour
 // 
 void VDUStreamProcessor::vdu_sys_cursorBehaviour() {
-	auto setting = readByte_t();	if (setting == -1) return;
-	auto mask = readByte_t();		if (mask == -1) return;
+	uint8_t args[2];
+	if (!readArgs_t(args, sizeof args)) return;
 
-	setCursorBehaviour((uint8_t) setting, (uint8_t) mask);
+	setCursorBehaviour(args[0], args[1]);
 }
 
 // VDU 23, c, n1, n2, n3, n4, n5, n6, n7, n8: Redefine a display character
@@ -485,13 +754,9 @@ void VDUStreamProcessor::vdu_sys_cursorBehaviour() {
 void VDUStreamProcessor::vdu_sys_udg(char c) {
 	uint8_t		buffer[8];
 
-	for (uint8_t i = 0; i < 8; i++) {
-		auto b = readByte_t();
-		if (b == -1) {
-			return;
-		}
-		buffer[i] = b;
-	}	
+	if (!readArgs_t(buffer, sizeof buffer)) {
+		return;
+	}
 
 	redefineCharacter(c, buffer);
 }
@@ -81,7 +81,7 @@ void setup() {
 	disableCore1WDT(); delay(200);
 	DBGSerial.begin(SERIALBAUDRATE, SERIAL_8N1, 3, 1);
 	setupVDPProtocol();
-	processor = new VDUStreamProcessor(&VDPSerial);
+	processor = new VDUStreamProcessor(getVDPStream());
 	processor->wait_eZ80();
 	setupKeyboardAndMouse();
 	init_audio();
@@ -101,6 +101,7 @@ void loop() {
 	while (true) {
 		if (terminalMode) {
 			do_keyboard_terminal();
+			VDPPacketWriter.flush();
 			continue;
 		}
 		cursorVisible = ((count & 0xFFFF) == 0);
@@ -112,8 +113,9 @@ void loop() {
 		}
 		do_keyboard();
 		do_mouse();
+		VDPPacketWriter.flush();
 
-		if (processor->byteAvailable()) {
+		if (processor->byteAvailable() || processor->commandPending()) {
 			if (cursorState) {
 				cursorState = false;
 				do_cursor();
@@ -171,11 +173,16 @@ void do_keyboard_terminal() {
 void do_mouse() {
 	// get mouse delta, if the mouse is active
 	MouseDelta delta;
+	bool immediate = false;
 	if (mouseMoved(&delta)) {
 		auto mouse = getMouse();
 		auto mStatus = mouse->status();
 		// update mouse cursor position if it's active
 		setMouseCursorPos(mStatus.X, mStatus.Y);
+		immediate = queueMouseReport(&delta);
+	}
+	// send accumulated movement once the report interval has passed
+	if (takeMouseReport(&delta, immediate)) {
 		processor->sendMouseData(&delta);
 	}
 }
@@ -222,6 +229,13 @@ void switchTerminalMode() {
 	cls(true);
 	canvas.reset();
 	Terminal.begin(_VGAController.get());	
+	// The terminal reads VDPSerial itself, so stop the receive task draining it
+	// and hand over anything already waiting in the ring
+	VDPPacketWriter.flush();
+	pauseVDPReceive();
+	while (VDPRxStream.available() > 0) {
+		Terminal.write(VDPRxStream.read());
+	}
 	Terminal.connectSerialPort(VDPSerial);
 	Terminal.enableCursor(true);
 	terminalMode = true;
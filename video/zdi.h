@@ -287,6 +287,7 @@ void ez80_serial_write (const char* szLine) {
 			down,
 		};
 		processor->send_packet(PACKET_KEYCODE, sizeof packet, packet);
+		VDPPacketWriter.flush();
         delayMicroseconds (100);
 	}
 }